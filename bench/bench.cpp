@@ -0,0 +1,353 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "block_cache.hpp"
+#include "codec.hpp"
+#include "dat_gen.hpp"
+#include "dat_map.hpp"
+#include "dat_proc.hpp"
+#include "dat_writer.hpp"
+#include "dxt_decode.hpp"
+#include "dxt_scan.hpp"
+#include "fix_block.hpp"
+#include "fix_dxt.hpp"
+
+static double Bench_Seconds = 0.5;
+
+// Runs f repeatedly for at least Bench_Seconds, returning seconds per call
+template<class F> static double measure(F f) {
+    typedef std::chrono::steady_clock clock;
+    std::size_t runs = 0;
+    const clock::time_point start = clock::now();
+    double elapsed;
+    do {
+        f();
+        ++runs;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < Bench_Seconds);
+    return elapsed / runs;
+}
+
+namespace {
+    struct bench_result {
+        std::string name;
+        std::vector<std::pair<const char *, double>> rates;
+    };
+}
+
+static std::vector<bench_result> Results;
+
+static void report(const std::string &name, double seconds, double bytes, double blocks, double entries = 0) {
+    bench_result result = { name, {} };
+    if (bytes > 0) result.rates.emplace_back("mb_per_s", bytes / seconds / 1e6);
+    if (blocks > 0) result.rates.emplace_back("blocks_per_s", blocks / seconds);
+    if (entries > 0) result.rates.emplace_back("entries_per_s", entries / seconds);
+    Results.push_back(result);
+}
+
+static std::size_t helper_blocks(const std::vector<char> &texture) {
+    return (texture.size() - sizeof(tex_header)) / sizeof(dxt5_chunk);
+}
+
+static void bench_fix_block() {
+    // Blocks that take the solver path: cs0 < cs1 and some 10b index
+    const std::vector<char> texture = make_texture(26, 256, 1.0, 2);
+    std::vector<dxt5_chunk> blocks;
+    for (std::size_t i = 0; i < helper_blocks(texture); ++i) {
+        dxt5_chunk chunk;
+        std::memcpy(&chunk, texture.data() + sizeof(tex_header) + i * sizeof(chunk), sizeof(chunk));
+        if (chunk.cs0 < chunk.cs1 && (chunk.cv & 0xAAAAAAAA) != 0) blocks.push_back(chunk);
+    }
+
+    std::vector<dxt5_chunk> work;
+    double seconds = measure([&]() {
+        work = blocks;
+        for (dxt5_chunk &chunk : work) fix_block(chunk);
+    });
+    report("fix_block", seconds, 0, static_cast<double>(blocks.size()));
+    double batched = measure([&]() {
+        work = blocks;
+        fix_blocks(work.data(), work.size());
+    });
+    report(std::string("fix_blocks_") + fix_blocks_isa(), batched, 0, static_cast<double>(blocks.size()));
+}
+
+// Differential test of fix_blocks against fix_block: every weight
+// distribution, random and edge-heavy endpoints, shuffled so that each
+// batch mixes distributions. False on the first mismatch.
+static bool check_fix_blocks(std::size_t rounds, std::uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<dxt5_chunk> blocks;
+    for (std::size_t round = 0; round < rounds; ++round) {
+        blocks.clear();
+        for (int w0 = 0; w0 <= 16; ++w0)
+            for (int w1 = 0; w0 + w1 <= 16; ++w1)
+                for (int k = 0; k < 16; ++k) {
+                    int index[16], n = 0;
+                    for (int i = 0; i < 16; ++i) index[n++] = i < w0 ? 0 : i < w0 + w1 ? 1 : 2;
+                    std::shuffle(index, index + 16, rng);
+                    dxt5_chunk chunk{};
+                    for (int i = 0; i < 16; ++i) chunk.cv |= static_cast<std::uint32_t>(index[i]) << (2 * i);
+                    chunk.cs0 = static_cast<std::uint16_t>(rng()), chunk.cs1 = static_cast<std::uint16_t>(rng());
+                    // Channels at 0 or full scale, where the extrapolations leave the range
+                    if (k & 1) chunk.cs0 &= static_cast<std::uint16_t>(0x0841 * (rng() & 0x1F));
+                    if (k & 2) chunk.cs1 |= static_cast<std::uint16_t>(rng() & 0xF81F);
+                    blocks.push_back(chunk);
+                }
+        std::shuffle(blocks.begin(), blocks.end(), rng);
+
+        std::vector<dxt5_chunk> batched = blocks;
+        fix_blocks(batched.data(), batched.size());
+        for (std::size_t i = 0; i < blocks.size(); ++i) {
+            dxt5_chunk expected = blocks[i];
+            fix_block(expected);
+            if (std::memcmp(&expected, &batched[i], sizeof(expected)) != 0) {
+                std::cerr << "fix_blocks (" << fix_blocks_isa() << ") differs from fix_block for cs0=" << blocks[i].cs0
+                          << " cs1=" << blocks[i].cs1 << " cv=" << blocks[i].cv << std::endl;
+                return false;
+            }
+        }
+    }
+    std::cout << "fix_blocks (" << fix_blocks_isa() << ") matches fix_block on " << rounds * blocks.size() << " blocks" << std::endl;
+    return true;
+}
+
+// The precomputed dist_table divisions against the per-block ones they replaced
+static bool check_dist_table() {
+    int w0, w1;
+    std::uint64_t compared;
+    if (!check_dist_divisions(w0, w1, compared)) {
+        std::cerr << "dist_table differs from integer division for w0=" << w0 << " w1=" << w1 << std::endl;
+        return false;
+    }
+    std::cout << "dist_table matches integer division on " << compared << " numerators" << std::endl;
+    return true;
+}
+
+static void bench_classify(double bad_ratio) {
+    const std::vector<char> texture = make_texture(26, 2048, bad_ratio, 1);
+    const std::size_t blocks = helper_blocks(texture);
+    const char *data = texture.data() + sizeof(tex_header);
+    std::vector<std::uint32_t> flagged;
+    flagged.reserve(blocks);
+
+    const std::string suffix = "_" + std::to_string(static_cast<int>(bad_ratio * 100)) + "pct_bad";
+    double scalar = measure([&]() { flagged.clear(); find_ambiguous_blocks_scalar(data, blocks, flagged); });
+    const std::size_t expected = flagged.size();
+    double vector = measure([&]() { flagged.clear(); find_ambiguous_blocks(data, blocks, flagged); });
+    if (flagged.size() != expected) throw std::runtime_error("classifier mismatch");
+    report("classify_scalar" + suffix, scalar, static_cast<double>(texture.size()), static_cast<double>(blocks));
+    report(std::string("classify_") + dxt_scan_isa() + suffix, vector, static_cast<double>(texture.size()), static_cast<double>(blocks));
+
+    std::vector<char> work;
+    double fix = measure([&]() { work = texture; fix_dxt(work); });
+    report("fix_dxt" + suffix, fix, static_cast<double>(texture.size()), static_cast<double>(blocks));
+}
+
+// Random blocks reach every color and alpha mode
+static std::vector<char> helper_decode_blocks() {
+    std::mt19937 rng(4);
+    std::vector<char> data(65536 * sizeof(dxt5_chunk));
+    for (char &c : data) c = static_cast<char>(rng());
+    return data;
+}
+
+// The decoders this CPU picked against the scalar ones; null if they
+// agree, else which one differs
+static const char *decode_mismatch(const std::vector<char> &data) {
+    const std::size_t blocks5 = data.size() / sizeof(dxt5_chunk), blocks1 = data.size() / 8;
+    std::vector<std::uint8_t> rgba(blocks1 * 64), expected(blocks1 * 64);
+    for (bool intended : { false, true }) {
+        decode_dxt5_blocks_scalar(data.data(), blocks5, expected.data(), intended);
+        decode_dxt5_blocks(data.data(), blocks5, rgba.data(), intended);
+        if (std::memcmp(expected.data(), rgba.data(), blocks5 * 64) != 0) return "DXT5 decoder mismatch";
+    }
+    decode_dxt1_blocks_scalar(data.data(), blocks1, expected.data());
+    decode_dxt1_blocks(data.data(), blocks1, rgba.data());
+    return expected != rgba ? "DXT1 decoder mismatch" : nullptr;
+}
+
+static bool check_decode() {
+    const std::vector<char> data = helper_decode_blocks();
+    if (const char *mismatch = decode_mismatch(data)) {
+        std::cerr << mismatch << " (" << dxt_decode_isa() << ")" << std::endl;
+        return false;
+    }
+    std::cout << "DXT decoders (" << dxt_decode_isa() << ") match the scalar ones on " << data.size() / 8 << " blocks" << std::endl;
+    return true;
+}
+
+// Rates are of the RGBA8 texels written
+static void bench_decode() {
+    const std::vector<char> data = helper_decode_blocks();
+    const std::size_t blocks5 = data.size() / sizeof(dxt5_chunk), blocks1 = data.size() / 8;
+    std::vector<std::uint8_t> rgba(blocks1 * 64);
+    if (const char *mismatch = decode_mismatch(data)) throw std::runtime_error(mismatch);
+
+    double scalar = measure([&]() { decode_dxt5_blocks_scalar(data.data(), blocks5, rgba.data()); });
+    double vector = measure([&]() { decode_dxt5_blocks(data.data(), blocks5, rgba.data()); });
+    report("decode_dxt5_scalar", scalar, blocks5 * 64.0, static_cast<double>(blocks5));
+    report(std::string("decode_dxt5_") + dxt_decode_isa(), vector, blocks5 * 64.0, static_cast<double>(blocks5));
+    scalar = measure([&]() { decode_dxt1_blocks_scalar(data.data(), blocks1, rgba.data()); });
+    vector = measure([&]() { decode_dxt1_blocks(data.data(), blocks1, rgba.data()); });
+    report("decode_dxt1_scalar", scalar, blocks1 * 64.0, static_cast<double>(blocks1));
+    report(std::string("decode_dxt1_") + dxt_decode_isa(), vector, blocks1 * 64.0, static_cast<double>(blocks1));
+}
+
+static void bench_codec() {
+    const std::vector<char> texture = make_texture(26, 512, 0.05, 3);
+    const double bytes = static_cast<double>(texture.size());
+    codec &engine = thread_codec();
+
+    std::vector<char> compressed;
+    double deflate = measure([&]() {
+        if (!engine.deflate(texture, compressed, texture.size() - 1, { Zlib_Compression_Level }))
+            throw std::runtime_error("benchmark texture did not compress");
+    });
+    report(std::string("compress_") + engine.name(), deflate, bytes, static_cast<double>(helper_blocks(texture)));
+
+    std::vector<char> decompressed(texture.size());
+    double inflate = measure([&]() { engine.inflate(compressed, decompressed); });
+    report(std::string("decompress_") + engine.name(), inflate, bytes, static_cast<double>(helper_blocks(texture)));
+}
+
+static void bench_archive(const dat_gen_options &options, const std::string &work) {
+    const std::string in_name = work + ".dat", out_name = work + ".out.dat";
+    {
+        const std::vector<char> archive = make_archive(options);
+        std::ofstream out(in_name, std::ios_base::out | std::ios_base::binary);
+        out.write(archive.data(), static_cast<std::streamsize>(archive.size()));
+        if (!out) throw std::ios_base::failure("Unable to write benchmark archive");
+    }
+
+    dat_map in(in_name);
+    const double bytes = static_cast<double>(in.size()), entries = static_cast<double>(in.files().size());
+    double names = measure([&]() { read_names(in); });
+    report(options.base64 ? "decode64" : "read_names", names, 0, 0, entries);
+
+    // process_textures reports every texture on cout, which would drown the JSON
+    std::streambuf *console = std::cout.rdbuf(nullptr);
+    double process;
+    try {
+        process = measure([&]() {
+            file_writer out(out_name, &in);
+            process_textures(in, out);
+        });
+    } catch (...) {
+        std::cout.rdbuf(console), std::cout.clear();
+        throw;
+    }
+    std::cout.rdbuf(console), std::cout.clear();
+    report("process_textures", process, bytes, 0, entries);
+
+    std::remove(out_name.c_str());
+    std::remove(in_name.c_str());
+}
+
+static void print_json(const dat_gen_options &options) {
+    std::cout << "{\n";
+    std::cout << "  \"isa\": \"" << dxt_scan_isa() << "\",\n";
+    std::cout << "  \"codec\": \"" << thread_codec().name() << "\",\n";
+    std::cout << "  \"archive\": { \"seed\": " << options.seed << ", \"entries\": " << options.entries
+              << ", \"base64\": " << (options.base64 ? "true" : "false") << ", \"dxt1_share\": " << options.dxt1_share
+              << ", \"bad_ratio\": " << options.bad_ratio << ", \"compressed_share\": " << options.compressed_share
+              << ", \"max_size\": " << options.max_size << " },\n";
+    std::cout << "  \"results\": {\n";
+    for (std::size_t i = 0; i < Results.size(); ++i) {
+        std::cout << "    \"" << Results[i].name << "\": {";
+        for (std::size_t k = 0; k < Results[i].rates.size(); ++k)
+            std::cout << (k == 0 ? " " : ", ") << '"' << Results[i].rates[k].first << "\": " << Results[i].rates[k].second;
+        std::cout << " }" << (i + 1 < Results.size() ? "," : "") << '\n';
+    }
+    std::cout << "  }\n}" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    dat_gen_options options;
+    std::string work = "mc2tex_bench_work", generate;
+    std::size_t check_rounds = 0;
+    bool check_dist = false, check_decoders = false;
+    // Every measurement repeats the same blocks, which a cache would only look up
+    Block_Cache_Bytes = 0;
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (std::strncmp(arg, "--entries=", 10) == 0) options.entries = std::strtoul(arg + 10, nullptr, 10);
+        else if (std::strncmp(arg, "--seed=", 7) == 0) options.seed = static_cast<std::uint32_t>(std::strtoul(arg + 7, nullptr, 10));
+        else if (std::strncmp(arg, "--dxt1=", 7) == 0) options.dxt1_share = std::atof(arg + 7);
+        else if (std::strncmp(arg, "--bad=", 6) == 0) options.bad_ratio = std::atof(arg + 6);
+        else if (std::strncmp(arg, "--compressed=", 13) == 0) options.compressed_share = std::atof(arg + 13);
+        else if (std::strncmp(arg, "--max-size=", 11) == 0) options.max_size = static_cast<std::uint16_t>(std::atoi(arg + 11));
+        else if (std::strcmp(arg, "--plain-names") == 0) options.base64 = false;
+        else if (std::strncmp(arg, "--seconds=", 10) == 0) Bench_Seconds = std::atof(arg + 10);
+        else if (std::strncmp(arg, "--work=", 7) == 0) work = arg + 7;
+        else if (std::strncmp(arg, "--generate=", 11) == 0) generate = arg + 11;
+        else if (std::strcmp(arg, "--check-batch") == 0) check_rounds = 100;
+        else if (std::strncmp(arg, "--check-batch=", 14) == 0) check_rounds = std::strtoul(arg + 14, nullptr, 10);
+        else if (std::strcmp(arg, "--check-dist") == 0) check_dist = true;
+        else if (std::strcmp(arg, "--check-decode") == 0) check_decoders = true;
+        else if (std::strncmp(arg, "--block-cache=", 14) == 0) Block_Cache_Bytes = std::strtoul(arg + 14, nullptr, 10) << 20;
+        else if (std::strncmp(arg, "-f", 2) == 0 && arg[2] >= '0' && arg[2] <= '9') Zlib_Compression_Level = arg[2] - '0';
+        else if (std::strncmp(arg, "-j", 2) == 0 && arg[2] >= '0' && arg[2] <= '9') Worker_Threads = std::atoi(arg + 2);
+        else if (std::strncmp(arg, "--codec=", 8) == 0) {
+            if (!parse_codec_backend(arg + 8, Codec_Backend) || !codec_available(Codec_Backend)) {
+                std::cerr << "ERROR - Compression backend " << (arg + 8) << " is not available" << std::endl;
+                return 1;
+            }
+        } else {
+            std::cout << "Usage: " << argv[0] << " [--entries=N] [--seed=N] [--dxt1=share] [--bad=ratio] [--compressed=share]" << std::endl;
+            std::cout << "       [--max-size=N] [--plain-names] [--seconds=S] [--work=path] [-fN] [-jN] [--codec=name]" << std::endl;
+            std::cout << "       [--block-cache=MiB] (off unless given)" << std::endl;
+            std::cout << "       " << argv[0] << " --generate=path [archive options] writes the synthetic archive and exits" << std::endl;
+            std::cout << "       " << argv[0] << " --check-batch[=rounds] [--seed=N] compares fix_blocks with fix_block and exits" << std::endl;
+            std::cout << "       " << argv[0] << " --check-dist checks the solver's precomputed divisions and exits" << std::endl;
+            std::cout << "       " << argv[0] << " --check-decode compares the DXT decoders with the scalar ones and exits" << std::endl;
+            return arg[0] == '-' && arg[1] == 'h' ? 0 : 1;
+        }
+    }
+
+    try {
+        if (!generate.empty()) {
+            const std::vector<char> archive = make_archive(options);
+            std::ofstream out(generate, std::ios_base::out | std::ios_base::binary);
+            out.write(archive.data(), static_cast<std::streamsize>(archive.size()));
+            if (!out) throw std::ios_base::failure("Unable to write archive");
+            return 0;
+        }
+
+        if (check_rounds != 0 || check_dist || check_decoders) {
+            bool ok = true;
+            if (check_dist) ok = check_dist_table() && ok;
+            if (check_decoders) ok = check_decode() && ok;
+            if (check_rounds != 0) ok = check_fix_blocks(check_rounds, options.seed) && ok;
+            return ok ? 0 : 1;
+        }
+
+        bench_fix_block();
+        bench_classify(0.0);
+        bench_classify(0.05);
+        bench_classify(0.5);
+        bench_decode();
+        bench_codec();
+        bench_archive(options, work);
+    } catch (std::exception &e) {
+        std::cerr << "ERROR - " << e.what() << std::endl;
+        return 1;
+    }
+
+    print_json(options);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "dat_gen.hpp"
+
+#include <cstring>
+
+#include <memory>
+#include <random>
+#include <string>
+
+#include "codec.hpp"
+#include "dat_format.hpp"
+#include "fix_dxt.hpp"
+
+constexpr char chartable[49] = "\0 #$()-./?0123456789_abcdefghijklmnopqrstuvwxyz~";
+
+template<class T> static void helper_append(std::vector<char> &out, const T &t) {
+    const char *p = reinterpret_cast<const char *>(&t);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+std::vector<char> make_texture(std::uint16_t type, std::uint16_t size, double bad_ratio, std::uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    // A small palette keeps the blocks about as compressible as real ones
+    std::uint16_t palette[16];
+    std::uint32_t patterns[8];
+    for (std::uint16_t &c : palette) c = static_cast<std::uint16_t>(rng());
+    for (std::uint32_t &p : patterns) p = static_cast<std::uint32_t>(rng());
+
+    tex_header header = { size, size, type, 0, 0, 0, 0 };
+    std::uint16_t last = 4;
+    if (type == 22 && chance(rng) < 0.5) last = 1; // chain runs on to 1x1
+    for (std::uint16_t s = size; s >= last; s /= 2) ++header.mmaps;
+
+    std::vector<char> texture;
+    helper_append(texture, header);
+    for (std::uint16_t s = size; s >= last; s /= 2) {
+        if (s < 4) {
+            texture.insert(texture.end(), s * s / 2 + 1, '\0');
+            continue;
+        }
+        for (std::size_t i = 0; i < static_cast<std::size_t>(s / 4) * (s / 4); ++i) {
+            std::uint16_t a = palette[rng() % 16], b = palette[rng() % 16];
+            if (a == b) ++a;
+            std::uint32_t cv = patterns[rng() % 8];
+            if (type == 22) {
+                helper_append(texture, a), helper_append(texture, b), helper_append(texture, cv);
+                continue;
+            }
+
+            dxt5_chunk chunk;
+            chunk.as[0] = 0xFF, chunk.as[1] = static_cast<std::uint8_t>(rng() % 4 * 0x40);
+            for (std::uint8_t &x : chunk.ax) x = static_cast<std::uint8_t>(patterns[rng() % 8]);
+            const bool bad = chance(rng) < bad_ratio;
+            chunk.cs0 = bad == (a > b) ? b : a, chunk.cs1 = bad == (a > b) ? a : b;
+            // three color indices only (no 11b), as the solver expects
+            if (bad) {
+                cv = 0;
+                for (int k = 0; k < 16; ++k) cv |= static_cast<std::uint32_t>(rng() % 3) << (2 * k);
+            }
+            chunk.cv = cv;
+            helper_append(texture, chunk);
+        }
+    }
+    return texture;
+}
+
+// Name table of the "Dave" format: 6-bit symbols, four to three bytes, each
+// name prefixed by how much it shares with the previous one
+static void helper_encode64(std::vector<char> &names, const std::string &name, const std::string &prev) {
+    std::size_t keep = 0;
+    while (keep < 127 && keep < name.size() && keep < prev.size() && name[keep] == prev[keep]) ++keep;
+
+    std::vector<std::uint8_t> symbols;
+    if (keep > 0) {
+        symbols.push_back(static_cast<std::uint8_t>(0x38 | (keep & 0x07)));
+        symbols.push_back(static_cast<std::uint8_t>(0x20 | (keep >> 3)));
+    }
+    for (std::size_t i = keep; i < name.size(); ++i)
+        symbols.push_back(static_cast<std::uint8_t>(std::strchr(chartable + 1, name[i]) - chartable));
+    symbols.push_back(0);
+    while (symbols.size() % 4 != 0) symbols.push_back(0);
+
+    for (std::size_t i = 0; i < symbols.size(); i += 4) {
+        const std::uint32_t v = symbols[i] | symbols[i + 1] << 6 | symbols[i + 2] << 12 | symbols[i + 3] << 18;
+        names.push_back(static_cast<char>(v)), names.push_back(static_cast<char>(v >> 8));
+        names.push_back(static_cast<char>(v >> 16));
+    }
+}
+
+std::vector<char> make_archive(const dat_gen_options &options) {
+    std::mt19937 rng(options.seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::unique_ptr<codec> zlib = make_codec(codec_backend::zlib);
+
+    dat_header header = { options.base64 ? MAGIC_Dave : MAGIC_DAVE, static_cast<std::uint32_t>(options.entries), 0, 0 };
+    header.metaLen = static_cast<std::uint32_t>((options.entries * sizeof(file_info) + 2047) & ~std::size_t(2047));
+
+    std::vector<file_info> files(options.entries);
+    std::vector<char> names;
+    std::string prev;
+    for (std::size_t i = 0; i < options.entries; ++i) {
+        const std::string name = "tex/set" + std::to_string(i / 64) + "/entry_" + std::to_string(i) + ".tex";
+        files[i].nameOffset = static_cast<std::uint32_t>(names.size());
+        if (options.base64) helper_encode64(names, name, prev);
+        else names.insert(names.end(), name.c_str(), name.c_str() + name.size() + 1);
+        prev = name;
+    }
+    header.nameLen = static_cast<std::uint32_t>(names.size());
+
+    std::vector<char> archive(2048 + header.metaLen);
+    std::memcpy(archive.data(), &header, sizeof(header));
+    archive.insert(archive.end(), names.begin(), names.end());
+
+    std::vector<char> compressed;
+    for (file_info &file : files) {
+        const std::uint16_t type = chance(rng) < options.dxt1_share ? 22 : 26;
+        std::uint16_t size = 4;
+        while (size < options.max_size && chance(rng) < 0.75) size *= 2;
+        const std::vector<char> texture = make_texture(type, size, options.bad_ratio, static_cast<std::uint32_t>(rng()));
+
+        const bool deflated = chance(rng) < options.compressed_share &&
+                              zlib->deflate(texture, compressed, texture.size() - 1, { 6 });
+        const std::vector<char> &payload = deflated ? compressed : texture;
+
+        // Don't pad if data can fit in padding, as the game's archives do
+        const std::size_t padding = (2048 - archive.size() % 2048) % 2048;
+        if (payload.size() > padding) archive.resize(archive.size() + padding);
+        file.dataOffset = static_cast<std::uint32_t>(archive.size());
+        file.decompressLen = static_cast<std::uint32_t>(texture.size());
+        file.compressLen = static_cast<std::uint32_t>(payload.size());
+        archive.insert(archive.end(), payload.begin(), payload.end());
+    }
+    archive.resize((archive.size() + 2047) & ~std::size_t(2047));
+    std::memcpy(archive.data() + 2048, files.data(), files.size() * sizeof(file_info));
+    return archive;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+// Deterministic synthetic archives and textures for the benchmarks
+struct dat_gen_options {
+    std::uint32_t seed = 1;
+    std::size_t entries = 400;
+    bool base64 = true;          // "Dave" delta-encoded names, else "DAVE" plain names
+    double dxt1_share = 0.3;     // type 22 textures, the rest are type 26
+    double bad_ratio = 0.05;     // type 26 blocks with cs0 <= cs1
+    double compressed_share = 0.7;
+    std::uint16_t max_size = 512;
+};
+
+// Type 26 (DXT5) or 22 (DXT1) texture, square, with a full mip chain. Type
+// 22 textures may run their chain below 4x4, which fix_dxt then truncates.
+std::vector<char> make_texture(std::uint16_t type, std::uint16_t size, double bad_ratio, std::uint32_t seed);
+
+// A whole archive laid out like the game's, entries 2048-aligned
+std::vector<char> make_archive(const dat_gen_options &options);
@@ -0,0 +1,74 @@
+#include "block_cache.hpp"
+
+std::size_t Block_Cache_Bytes = 16 << 20;
+
+constexpr std::size_t block_cache::BucketSlots;
+
+block_cache::block_cache(std::size_t bytes) {
+    std::size_t buckets = 1;
+    while (buckets * 2 * BucketSlots * sizeof(slot) <= bytes) buckets *= 2;
+    table.reset(new slot[buckets * BucketSlots]);
+    for (std::size_t i = 0; i < buckets * BucketSlots; ++i) {
+        table[i].seq.store(0, std::memory_order_relaxed);
+        table[i].key.store(0, std::memory_order_relaxed);
+        table[i].value.store(0, std::memory_order_relaxed);
+    }
+    mask = buckets - 1;
+}
+
+std::size_t block_cache::bucket(std::uint64_t key) const {
+    // Fibonacci hashing; the high bits mix in all of cs0, cs1 and cv
+    return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+bool block_cache::find(std::uint64_t key, std::uint64_t &value) const {
+    const slot *s = &table[bucket(key) * BucketSlots];
+    for (std::size_t i = 0; i < BucketSlots; ++i, ++s) {
+        const std::uint32_t before = s->seq.load(std::memory_order_acquire);
+        if (before & 1) continue;
+        if (s->key.load(std::memory_order_relaxed) != key) continue;
+        const std::uint64_t v = s->value.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s->seq.load(std::memory_order_relaxed) != before) continue; // rewritten under us
+        value = v;
+        return true;
+    }
+    return false;
+}
+
+void block_cache::insert(std::uint64_t key, std::uint64_t value) {
+    slot *first = &table[bucket(key) * BucketSlots];
+    // A free slot, or else one picked by other bits of the hash
+    slot *s = nullptr;
+    for (std::size_t i = 0; i < BucketSlots && s == nullptr; ++i) {
+        const std::uint64_t k = first[i].key.load(std::memory_order_relaxed);
+        if (k == key) return;
+        if (k == 0) s = &first[i];
+    }
+    if (s == nullptr) s = &first[(key * 0x9E3779B97F4A7C15ull) >> 62];
+
+    std::uint32_t seq = s->seq.load(std::memory_order_relaxed);
+    if ((seq & 1) || !s->seq.compare_exchange_strong(seq, seq + 1, std::memory_order_relaxed)) return;
+    std::atomic_thread_fence(std::memory_order_release);
+    s->key.store(key, std::memory_order_relaxed);
+    s->value.store(value, std::memory_order_relaxed);
+    s->seq.store(seq + 2, std::memory_order_release);
+}
+
+block_cache *shared_block_cache() {
+    static const std::unique_ptr<block_cache> cache(Block_Cache_Bytes != 0 ? new block_cache(Block_Cache_Bytes) : nullptr);
+    return cache.get();
+}
+
+static std::atomic<std::uint64_t> Cache_Blocks(0), Cache_Hits(0), Cache_Duplicates(0);
+
+void block_cache_count(std::uint64_t blocks, std::uint64_t hits, std::uint64_t duplicates) {
+    Cache_Blocks.fetch_add(blocks, std::memory_order_relaxed);
+    Cache_Hits.fetch_add(hits, std::memory_order_relaxed);
+    Cache_Duplicates.fetch_add(duplicates, std::memory_order_relaxed);
+}
+
+block_cache_counts block_cache_totals() {
+    return { Cache_Blocks.load(std::memory_order_relaxed), Cache_Hits.load(std::memory_order_relaxed),
+             Cache_Duplicates.load(std::memory_order_relaxed) };
+}
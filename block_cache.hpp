@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// --block-cache=MiB: memory for the fixed color blocks shared by every
+// worker for the whole run; 0 turns the cache off
+extern std::size_t Block_Cache_Bytes;
+
+// The fixed color half (cs0, cs1, cv) of DXT5 blocks, by their original
+// color half. A fixed number of slots in buckets of four, each slot a
+// seqlock: lookups take no lock, and an insert into a slot that is being
+// written meanwhile is dropped. A full bucket gives up a slot picked by
+// the key.
+class block_cache {
+public:
+    explicit block_cache(std::size_t bytes);
+
+    block_cache(const block_cache &) = delete;
+    block_cache &operator=(const block_cache &) = delete;
+
+    // key 0 is never a block that needs solving, and marks free slots
+    bool find(std::uint64_t key, std::uint64_t &value) const;
+    void insert(std::uint64_t key, std::uint64_t value);
+
+    std::size_t slots() const { return (mask + 1) * BucketSlots; }
+
+private:
+    static constexpr std::size_t BucketSlots = 4;
+
+    struct slot {
+        std::atomic<std::uint32_t> seq; // odd while being written
+        std::atomic<std::uint64_t> key, value;
+    };
+
+    std::size_t bucket(std::uint64_t key) const;
+
+    std::unique_ptr<slot[]> table;
+    std::size_t mask; // buckets - 1
+};
+
+// The cache of this run, made on first use with Block_Cache_Bytes;
+// nullptr if that is 0
+block_cache *shared_block_cache();
+
+// Solver blocks seen by fix_dxt5_blocks, how many of them were found in
+// the cache, and how many were copies of another block solved in the same call
+struct block_cache_counts {
+    std::uint64_t blocks, hits, duplicates;
+};
+void block_cache_count(std::uint64_t blocks, std::uint64_t hits, std::uint64_t duplicates);
+block_cache_counts block_cache_totals();
@@ -0,0 +1,155 @@
+#include "codec.hpp"
+
+#include <cstring>
+
+#include <new>
+
+#include <zlib.h>
+#ifdef MC2_HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include "codec_zstream.hpp"
+#include "mc2_exception.hpp"
+
+codec_backend Codec_Backend = codec_backend::zlib;
+
+#ifdef MC2_HAVE_ZLIB_NG
+std::unique_ptr<codec> make_zlib_ng_codec(); // codec_zlib_ng.cpp
+#endif
+
+// Calls shared by zlib and the zlib-ng native API
+struct zlib_api {
+    typedef z_stream stream;
+    typedef uInt size_type;
+    static const char *name() { return "zlib"; }
+    static int inflate_init(stream *s) { return inflateInit2(s, -MAX_WBITS); }
+    static int inflate_reset(stream *s) { return inflateReset(s); }
+    static int inflate(stream *s, int flush) { return ::inflate(s, flush); }
+    static int inflate_end(stream *s) { return inflateEnd(s); }
+    static int deflate_init(stream *s, const deflate_params &params) {
+        return deflateInit2(s, params.level, Z_DEFLATED, -MAX_WBITS, params.memLevel, params.strategy);
+    }
+    static int deflate_reset(stream *s) { return deflateReset(s); }
+    static int deflate(stream *s, int flush) { return ::deflate(s, flush); }
+    static int deflate_end(stream *s) { return deflateEnd(s); }
+};
+
+#ifdef MC2_HAVE_LIBDEFLATE
+class libdeflate_codec : public codec {
+public:
+    libdeflate_codec() : decompressor(libdeflate_alloc_decompressor()) {
+        if (decompressor == nullptr) throw std::bad_alloc();
+    }
+    ~libdeflate_codec() {
+        libdeflate_free_decompressor(decompressor);
+        if (compressor != nullptr) libdeflate_free_compressor(compressor);
+    }
+
+    const char *name() const override { return "libdeflate"; }
+
+    void inflate(span<const char> in, span<char> out) override {
+        std::size_t read, written;
+        libdeflate_result ret = libdeflate_deflate_decompress_ex(decompressor, in.data(), in.size(),
+                                                                 out.data(), out.size(), &read, &written);
+        if (ret != LIBDEFLATE_SUCCESS && ret != LIBDEFLATE_SHORT_OUTPUT) throw mc2_exception("libdeflate: invalid deflate stream");
+        if (ret == LIBDEFLATE_SHORT_OUTPUT || written != out.size()) throw mc2_exception("Decompressed size incorrect");
+        if (read != in.size()) throw mc2_exception("Compressed size incorrect");
+    }
+
+    bool deflate(span<const char> in, std::vector<char> &out, std::size_t limit, const deflate_params &params) override {
+        // libdeflate levels run from 0 to 12, with zlib's default at 6
+        const int level = params.level < 0 ? 6 : params.level;
+        if (compressor == nullptr || level != compressorLevel) {
+            if (compressor != nullptr) libdeflate_free_compressor(compressor);
+            compressor = libdeflate_alloc_compressor(level);
+            if (compressor == nullptr) throw std::bad_alloc();
+            compressorLevel = level;
+        }
+        out.resize(limit);
+        std::size_t size = libdeflate_deflate_compress(compressor, in.data(), in.size(), out.data(), out.size());
+        if (size == 0) return false; // didn't fit
+        out.resize(size);
+        return true;
+    }
+
+private:
+    libdeflate_decompressor *decompressor;
+    libdeflate_compressor *compressor = nullptr;
+    int compressorLevel = 0;
+};
+#endif
+
+struct codec::prefix_stream {
+    z_stream strm;
+    prefix_stream() {
+        std::memset(&strm, 0, sizeof(strm));
+        int ret = inflateInit2(&strm, -MAX_WBITS);
+        if (ret != Z_OK) throw zlib_exception(ret, strm.msg);
+    }
+    ~prefix_stream() { inflateEnd(&strm); }
+};
+
+codec::codec() = default;
+codec::~codec() = default;
+
+bool codec::inflate_prefix(span<const char> in, span<char> out) {
+    int ret;
+    if (!prefix) prefix.reset(new prefix_stream());
+    else if ((ret = inflateReset(&prefix->strm)) != Z_OK) throw zlib_exception(ret, prefix->strm.msg);
+
+    z_stream &strm = prefix->strm;
+    strm.avail_in = static_cast<uInt>(in.size());
+    strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    strm.avail_out = static_cast<uInt>(out.size());
+    strm.next_out = reinterpret_cast<Bytef *>(out.data());
+
+    ret = ::inflate(&strm, Z_SYNC_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END) throw zlib_exception(ret, strm.msg);
+    if (strm.avail_out != 0) throw mc2_exception("Unable to decompress Tex header");
+    return ret != Z_STREAM_END;
+}
+
+bool codec_available(codec_backend backend) {
+    switch (backend) {
+        case codec_backend::zlib: return true;
+#ifdef MC2_HAVE_LIBDEFLATE
+        case codec_backend::libdeflate: return true;
+#endif
+#ifdef MC2_HAVE_ZLIB_NG
+        case codec_backend::zlib_ng: return true;
+#endif
+        default: return false;
+    }
+}
+
+bool parse_codec_backend(const char *name, codec_backend &backend) {
+    if (std::strcmp(name, "zlib") == 0) backend = codec_backend::zlib;
+    else if (std::strcmp(name, "libdeflate") == 0) backend = codec_backend::libdeflate;
+    else if (std::strcmp(name, "zlib-ng") == 0) backend = codec_backend::zlib_ng;
+    else return false;
+    return true;
+}
+
+std::unique_ptr<codec> make_codec(codec_backend backend) {
+    switch (backend) {
+        case codec_backend::zlib: return std::unique_ptr<codec>(new zstream_codec<zlib_api>());
+#ifdef MC2_HAVE_LIBDEFLATE
+        case codec_backend::libdeflate: return std::unique_ptr<codec>(new libdeflate_codec());
+#endif
+#ifdef MC2_HAVE_ZLIB_NG
+        case codec_backend::zlib_ng: return make_zlib_ng_codec();
+#endif
+        default: throw mc2_exception("Compression backend not available in this build");
+    }
+}
+
+codec &thread_codec() {
+    thread_local std::unique_ptr<codec> instance;
+    thread_local codec_backend backend;
+    if (!instance || backend != Codec_Backend) {
+        instance = make_codec(Codec_Backend);
+        backend = Codec_Backend;
+    }
+    return *instance;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+
+#include <memory>
+#include <vector>
+
+#include "span.hpp"
+
+// Raw deflate streams, as stored in DAT archives (zlib -MAX_WBITS).
+// Every backend must write streams that plain zlib can inflate.
+enum class codec_backend { zlib, libdeflate, zlib_ng };
+
+extern codec_backend Codec_Backend;
+
+// deflateInit2 settings. strategy and memLevel only apply to the zlib-style
+// backends; the others go by level alone.
+struct deflate_params {
+    int level;
+    int strategy = 0; // Z_DEFAULT_STRATEGY
+    int memLevel = 9; // MAX_MEM_LEVEL
+};
+
+inline bool operator==(const deflate_params &a, const deflate_params &b) {
+    return a.level == b.level && a.strategy == b.strategy && a.memLevel == b.memLevel;
+}
+inline bool operator!=(const deflate_params &a, const deflate_params &b) { return !(a == b); }
+
+class codec {
+public:
+    codec();
+    virtual ~codec();
+    virtual const char *name() const = 0;
+
+    // Inflates a whole stream, which must fill out exactly and end with in
+    virtual void inflate(span<const char> in, span<char> out) = 0;
+
+    // Deflates in. Returns false if the stream would not fit in limit bytes,
+    // otherwise out holds exactly the compressed stream.
+    virtual bool deflate(span<const char> in, std::vector<char> &out, std::size_t limit, const deflate_params &params) = 0;
+
+    // Inflates only the first out.size() bytes, without finishing the stream.
+    // Returns false if the stream ends right there. Always done with zlib,
+    // which can stop early, unlike some of the backends.
+    bool inflate_prefix(span<const char> in, span<char> out);
+
+private:
+    struct prefix_stream;
+    std::unique_ptr<prefix_stream> prefix;
+};
+
+bool codec_available(codec_backend backend);
+bool parse_codec_backend(const char *name, codec_backend &backend);
+
+// Throws if the backend was not found when this was built
+std::unique_ptr<codec> make_codec(codec_backend backend);
+
+// Long-lived codec of the calling thread for Codec_Backend, so that the
+// (de)compression state is reset between entries instead of reallocated
+codec &thread_codec();
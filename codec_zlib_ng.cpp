@@ -0,0 +1,31 @@
+#ifdef MC2_HAVE_ZLIB_NG
+
+#include <cstdint>
+
+#include <memory>
+
+#include <zlib-ng.h>
+
+#include "codec_zstream.hpp"
+
+struct zlib_ng_api {
+    typedef zng_stream stream;
+    typedef uint32_t size_type;
+    static const char *name() { return "zlib-ng"; }
+    static int inflate_init(stream *s) { return zng_inflateInit2(s, -MAX_WBITS); }
+    static int inflate_reset(stream *s) { return zng_inflateReset(s); }
+    static int inflate(stream *s, int flush) { return zng_inflate(s, flush); }
+    static int inflate_end(stream *s) { return zng_inflateEnd(s); }
+    static int deflate_init(stream *s, const deflate_params &params) {
+        return zng_deflateInit2(s, params.level, Z_DEFLATED, -MAX_WBITS, params.memLevel, params.strategy);
+    }
+    static int deflate_reset(stream *s) { return zng_deflateReset(s); }
+    static int deflate(stream *s, int flush) { return zng_deflate(s, flush); }
+    static int deflate_end(stream *s) { return zng_deflateEnd(s); }
+};
+
+std::unique_ptr<codec> make_zlib_ng_codec() {
+    return std::unique_ptr<codec>(new zstream_codec<zlib_ng_api>());
+}
+
+#endif
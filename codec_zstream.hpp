@@ -0,0 +1,80 @@
+#pragma once
+
+// zstream_codec, shared by the zlib and zlib-ng backends. Include it after
+// zlib.h or zlib-ng.h, which can't be used in the same translation unit.
+
+#include <cstring>
+
+#include <vector>
+
+#include "codec.hpp"
+#include "mc2_exception.hpp"
+
+// api wraps the stream type and calls of one of the libraries
+template<class api> class zstream_codec : public codec {
+public:
+    ~zstream_codec() {
+        if (inflating) api::inflate_end(&inf);
+        if (deflating) api::deflate_end(&def);
+    }
+
+    const char *name() const override { return api::name(); }
+
+    void inflate(span<const char> in, span<char> out) override {
+        int ret;
+        if (!inflating) {
+            std::memset(&inf, 0, sizeof(inf));
+            ret = api::inflate_init(&inf);
+            if (ret != Z_OK) throw zlib_exception(ret, inf.msg);
+            inflating = true;
+        } else {
+            ret = api::inflate_reset(&inf);
+            if (ret != Z_OK) throw zlib_exception(ret, inf.msg);
+        }
+
+        inf.avail_in = static_cast<typename api::size_type>(in.size());
+        inf.next_in = reinterpret_cast<unsigned char *>(const_cast<char *>(in.data()));
+        inf.avail_out = static_cast<typename api::size_type>(out.size());
+        inf.next_out = reinterpret_cast<unsigned char *>(out.data());
+
+        ret = api::inflate(&inf, Z_FINISH);
+        if (ret != Z_STREAM_END) throw zlib_exception(ret, inf.msg);
+        if (inf.avail_out != 0) throw mc2_exception("Decompressed size incorrect");
+        if (inf.avail_in != 0) throw mc2_exception("Compressed size incorrect");
+    }
+
+    bool deflate(span<const char> in, std::vector<char> &out, std::size_t limit, const deflate_params &params) override {
+        int ret;
+        if (deflating && params != deflateParams) {
+            api::deflate_end(&def);
+            deflating = false;
+        }
+        if (!deflating) {
+            std::memset(&def, 0, sizeof(def));
+            ret = api::deflate_init(&def, params);
+            if (ret != Z_OK) throw zlib_exception(ret, def.msg);
+            deflating = true, deflateParams = params;
+        } else {
+            ret = api::deflate_reset(&def);
+            if (ret != Z_OK) throw zlib_exception(ret, def.msg);
+        }
+
+        out.resize(limit);
+        def.avail_in = static_cast<typename api::size_type>(in.size());
+        def.next_in = reinterpret_cast<unsigned char *>(const_cast<char *>(in.data()));
+        def.avail_out = static_cast<typename api::size_type>(out.size());
+        def.next_out = reinterpret_cast<unsigned char *>(out.data());
+
+        ret = api::deflate(&def, Z_FINISH);    /* no bad return value */
+        if (ret == Z_OK) return false; // ran out of room, so compression doesn't pay
+        if (ret != Z_STREAM_END) throw zlib_exception(ret, def.msg);
+        if (def.avail_in != 0) throw mc2_exception("Texture not completely compressed?");
+        out.resize(out.size() - def.avail_out);
+        return true;
+    }
+
+private:
+    typename api::stream inf, def;
+    bool inflating = false, deflating = false;
+    deflate_params deflateParams = { 0 };
+};
@@ -0,0 +1,189 @@
+#include "dat_batch.hpp"
+
+#include <cctype>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "thread_pool.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+static bool helper_is_dat(const std::string &name) {
+    if (name.size() < 4) return false;
+    std::string ext = name.substr(name.size() - 4);
+    for (char &c : ext) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return ext == ".dat";
+}
+
+#ifdef _WIN32
+
+static bool helper_is_dir(const std::string &path) {
+    const DWORD attributes = GetFileAttributesA(path.c_str());
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+}
+
+static void helper_list_dir(const std::string &dir, std::vector<std::string> &files, std::vector<std::string> &dirs) {
+    WIN32_FIND_DATAA found;
+    HANDLE search = FindFirstFileA((dir + "\\*").c_str(), &found);
+    if (search == INVALID_HANDLE_VALUE) throw std::ios_base::failure("Unable to list directory " + dir);
+    do {
+        const std::string name = found.cFileName;
+        if (name == "." || name == "..") continue;
+        if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) dirs.push_back(dir + '\\' + name);
+        else files.push_back(dir + '\\' + name);
+    } while (FindNextFileA(search, &found));
+    FindClose(search);
+}
+
+#else
+
+static bool helper_is_dir(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void helper_list_dir(const std::string &dir, std::vector<std::string> &files, std::vector<std::string> &dirs) {
+    DIR *handle = opendir(dir.c_str());
+    if (handle == nullptr) throw std::ios_base::failure("Unable to list directory " + dir);
+    while (const dirent *entry = readdir(handle)) {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+        const std::string path = dir + '/' + name;
+        if (helper_is_dir(path)) dirs.push_back(path);
+        else files.push_back(path);
+    }
+    closedir(handle);
+}
+
+#endif
+
+// *.dat under dir, in name order, with each subdirectory after the files beside it
+static void helper_find_dats(const std::string &dir, std::vector<std::string> &out) {
+    std::vector<std::string> files, dirs;
+    helper_list_dir(dir, files, dirs);
+    std::sort(files.begin(), files.end());
+    std::sort(dirs.begin(), dirs.end());
+    for (const std::string &file : files)
+        if (helper_is_dat(file)) out.push_back(file);
+    for (const std::string &sub : dirs) helper_find_dats(sub, out);
+}
+
+static void helper_find_files(const std::string &dir, const std::string &prefix, std::vector<std::string> &out) {
+    std::vector<std::string> files, dirs;
+    helper_list_dir(dir, files, dirs);
+    for (const std::string &file : files) out.push_back(prefix + file.substr(dir.size() + 1));
+    for (const std::string &sub : dirs) helper_find_files(sub, prefix + sub.substr(dir.size() + 1) + '/', out);
+}
+
+std::vector<std::string> find_files(const std::string &dir) {
+    if (!helper_is_dir(dir)) throw std::ios_base::failure("Not a directory: " + dir);
+    std::vector<std::string> out;
+    helper_find_files(dir, "", out);
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+bool names_archives(const std::string &arg) {
+    return (arg.size() > 1 && arg[0] == '@') || helper_is_dir(arg);
+}
+
+static void helper_expand(const std::string &arg, std::vector<std::string> &out, unsigned depth) {
+    if (arg.size() > 1 && arg[0] == '@') {
+        if (depth > 8) throw std::ios_base::failure("List files nested too deeply at " + arg);
+        std::ifstream list(arg.substr(1));
+        if (!list) throw std::ios_base::failure("Unable to open list file " + arg.substr(1));
+        std::string line;
+        while (std::getline(list, line)) {
+            while (!line.empty() && std::isspace(static_cast<unsigned char>(line.back()))) line.pop_back();
+            std::size_t start = 0;
+            while (start < line.size() && std::isspace(static_cast<unsigned char>(line[start]))) ++start;
+            if (start == line.size() || line[start] == '#') continue;
+            helper_expand(line.substr(start), out, depth + 1);
+        }
+    } else if (helper_is_dir(arg)) {
+        helper_find_dats(arg, out);
+    } else {
+        out.push_back(arg);
+    }
+}
+
+std::vector<std::string> expand_archive_args(const std::vector<std::string> &args) {
+    std::vector<std::string> out;
+    for (const std::string &arg : args) helper_expand(arg, out, 0);
+    return out;
+}
+
+void process_batch(std::vector<batch_archive> &archives, const std::function<void(const std::string &)> &process,
+                   const std::function<void(const batch_archive &)> &done) {
+    if (archives.empty()) return;
+    const unsigned workers = Worker_Threads > 0 ? static_cast<unsigned>(Worker_Threads) : 0;
+    thread_pool pool(workers);
+    std::unique_ptr<thread_pool> search;
+    if (Optimize_Compression) search.reset(new thread_pool(workers));
+    struct shared_scope {
+        shared_scope(thread_pool &pool, thread_pool *search) { Shared_Pool = &pool, Search_Pool = search; }
+        ~shared_scope() { Shared_Pool = nullptr, Search_Pool = nullptr; }
+    } scope(pool, search.get());
+
+    // Each driver reads and commits one archive at a time, in entry order;
+    // a few of them keep the shared pool fed from several archives at once
+    const std::size_t drivers = std::min<std::size_t>(archives.size(), std::max(2u, pool.size() / 2));
+    std::mutex lock;
+    std::condition_variable finished;
+    std::deque<std::size_t> ready;
+    std::size_t next = 0;
+    const auto drive = [&]() {
+        for (;;) {
+            std::size_t i;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (next == archives.size()) return;
+                i = next++;
+            }
+            batch_archive &archive = archives[i];
+            Archive_Tally = &archive.tally;
+            try {
+                process(archive.path);
+                archive.ok = true;
+            } catch (std::exception &e) {
+                archive.error = e.what();
+            } catch (...) {
+                archive.error = "Unknown error";
+            }
+            Archive_Tally = nullptr;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                ready.push_back(i);
+            }
+            finished.notify_one();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t d = 0; d < drivers; ++d) threads.emplace_back(drive);
+    for (std::size_t reported = 0; reported < archives.size(); ++reported) {
+        std::size_t i;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [&ready]() { return !ready.empty(); });
+            i = ready.front();
+            ready.pop_front();
+        }
+        done(archives[i]);
+    }
+    for (std::thread &t : threads) t.join();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "dat_proc.hpp"
+
+// The archives named on a batch command line: files as given, directories
+// searched recursively for *.dat, and @listfile read as one path per line
+// (blank lines and # comments skipped), which may again be directories.
+std::vector<std::string> expand_archive_args(const std::vector<std::string> &args);
+// True for a directory or @listfile, which can stand for any number of archives
+bool names_archives(const std::string &arg);
+// Every file under dir, as paths relative to it joined with '/', in name order
+std::vector<std::string> find_files(const std::string &dir);
+
+struct batch_archive {
+    std::string path;
+    bool ok = false;
+    std::string error; // what() of the exception it failed with
+    archive_tally tally;
+};
+
+// Runs process on every archive, several at once, while the entries of all
+// of them share one worker pool (Shared_Pool for the duration), so the
+// cores stay busy when an archive is mostly not textures. An archive that
+// throws is recorded as failed and the rest carry on. done is called on
+// this thread as each archive finishes.
+void process_batch(std::vector<batch_archive> &archives, const std::function<void(const std::string &)> &process,
+                   const std::function<void(const batch_archive &)> &done);
@@ -0,0 +1,220 @@
+#include "dat_extract.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <deque>
+#include <fstream>
+#include <future>
+#include <ios>
+#include <iostream>
+#include <map>
+#include <tuple>
+
+#include "codec.hpp"
+#include "dat_map.hpp"
+#include "dat_pack.hpp"
+#include "dat_proc.hpp"
+#include "mc2_exception.hpp"
+#include "name_table.hpp"
+#include "span.hpp"
+#include "thread_pool.hpp"
+#include "xxhash.hpp"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+static void helper_make_dir(const std::string &path) {
+#ifdef _WIN32
+    const int ret = _mkdir(path.c_str());
+#else
+    const int ret = mkdir(path.c_str(), 0777);
+#endif
+    if (ret != 0 && errno != EEXIST) throw std::ios_base::failure("Unable to create directory " + path);
+}
+
+// Archive names are relative; anything that could climb out of dir is refused
+std::string entry_path(const std::string &dir, span<const char> name, bool make_dirs) {
+    std::string path = dir;
+    std::string component;
+    for (std::size_t i = 0; i <= name.size(); ++i) {
+        const char c = i < name.size() ? name[i] : '/';
+        if (c != '/' && c != '\\') {
+            component += c;
+            continue;
+        }
+        if (component.empty() || component == "." || component == "..") {
+            std::cout.write(name.data(), name.size()) << " - " << std::flush;
+            throw mc2_exception("Entry name would leave the output directory");
+        }
+        if (make_dirs && i < name.size()) helper_make_dir(path + '/' + component);
+        path += '/' + component;
+        component.clear();
+    }
+    return path;
+}
+
+namespace {
+
+struct extracted {
+    std::size_t size;
+    pack_record record;
+    std::vector<char> kept; // the stream, when no zlib setting makes it again
+};
+
+}
+
+// describe fills in the pack record of the entry as well
+static extracted helper_extract(const dat_map &in, const std::string &dir, span<const char> name, const file_info &file,
+                                bool describe) {
+    const span<const char> payload = in.payload(file);
+    std::vector<char> data;
+    if (file.compressLen < file.decompressLen) {
+        data.resize(file.decompressLen);
+        thread_codec().inflate(payload, data);
+    } else if (file.compressLen == file.decompressLen) {
+        data.assign(payload.begin(), payload.end());
+    } else throw mc2_exception("Compressed entry larger than decompressed is invalid");
+
+    std::ofstream out(entry_path(dir, name, true), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!out.write(data.data(), static_cast<std::streamsize>(data.size())))
+        throw std::ios_base::failure("Unable to write " + std::string(name.begin(), name.end()));
+
+    extracted result = { data.size(), { file, 0, pack_method::stored, 0, 0, 0, 0 }, { } };
+    if (!describe) return result;
+    result.record.hash = xxhash64(data.data(), data.size());
+    deflate_params params = { 0 };
+    if (file.compressLen == file.decompressLen) {
+        result.record.method = pack_method::stored;
+    } else if (find_deflate_params(data, payload, params)) {
+        result.record.method = pack_method::deflated;
+        result.record.level = static_cast<std::uint8_t>(params.level);
+        result.record.memLevel = static_cast<std::uint8_t>(params.memLevel);
+    } else {
+        result.record.method = pack_method::kept;
+        result.kept.assign(payload.begin(), payload.end());
+    }
+    return result;
+}
+
+// Extracts the entries which, inflating them across the workers, and
+// fills in index for every entry if given
+static std::size_t helper_extract_all(const dat_map &in, const name_table &table, const std::string &dir,
+                                      const std::vector<std::size_t> &which, pack_index *index) {
+    const span<const file_info> files = in.files();
+    // With an index, entries sharing their data with an earlier one take its record
+    std::vector<std::size_t> leader(which.size());
+    std::map<std::tuple<std::uint32_t, std::uint32_t, std::uint32_t>, std::size_t> first;
+    for (std::size_t k = 0; k < which.size(); ++k) {
+        const file_info &file = files[which[k]];
+        leader[k] = index != nullptr ? first.emplace(std::make_tuple(file.dataOffset, file.compressLen, file.decompressLen), k).first->second : k;
+    }
+
+    // Declared before the pool so that the workers are joined first
+    std::deque<std::future<extracted>> pending;
+    thread_pool pool(Worker_Threads > 0 ? static_cast<unsigned>(Worker_Threads) : 0);
+    const std::size_t window = 2 * static_cast<std::size_t>(pool.size());
+    std::size_t committed = 0;
+    const auto commit_front = [&]() {
+        extracted result = pending.front().get();
+        pending.pop_front();
+        const std::size_t k = committed++;
+        const span<const char> name = table[which[k]];
+        if (index != nullptr) {
+            pack_record &record = index->records[which[k]];
+            if (leader[k] == k) {
+                record = result.record;
+                if (record.method == pack_method::kept) {
+                    record.keptOffset = static_cast<std::uint32_t>(index->kept.size());
+                    index->kept.insert(index->kept.end(), result.kept.begin(), result.kept.end());
+                }
+            } else {
+                record = index->records[which[leader[k]]];
+                record.file = files[which[k]];
+            }
+        }
+        if (!Quiet_Output) std::cout.write(name.data(), name.size()) << " - " << result.size << " bytes" << std::endl;
+    };
+    for (std::size_t k = 0; k < which.size(); ++k) {
+        const std::size_t i = which[k];
+        const bool describe = index != nullptr && leader[k] == k;
+        pending.push_back(pool.submit([&in, &table, &dir, &files, i, describe]() {
+            return helper_extract(in, dir, table[i], files[i], describe);
+        }));
+        while (pending.size() > window) commit_front();
+    }
+    while (!pending.empty()) commit_front();
+    return which.size();
+}
+
+// Whether pack, laying out the data in the order it is in now, puts every
+// entry back where it is
+static bool helper_packs_back(const dat_map &in) {
+    const dat_header &header = in.header();
+    std::map<std::uint32_t, std::uint32_t> extents;
+    for (const file_info &file : in.files()) {
+        const auto extent = extents.emplace(file.dataOffset, file.compressLen);
+        if (!extent.second && extent.first->second != file.compressLen) return false;
+    }
+    std::uint64_t pos = 2048 + static_cast<std::uint64_t>(header.metaLen) + header.nameLen;
+    for (const auto &extent : extents) {
+        const std::uint64_t padding = (2048 - pos % 2048) % 2048;
+        if (extent.second > padding) pos += padding;
+        if (pos != extent.first) return false;
+        pos += extent.second;
+    }
+    return ((pos + 2047) & ~static_cast<std::uint64_t>(2047)) == in.size();
+}
+
+std::size_t extract_entries(const dat_map &in, const std::string &dir, const std::vector<std::string> &names) {
+    const name_table table(in.header(), in.files(), in.names());
+    helper_make_dir(dir);
+
+    std::vector<std::size_t> which;
+    for (const std::string &name : names) {
+        if (name.find_first_of("*?") == std::string::npos) {
+            const std::size_t i = table.find(name);
+            if (i == name_table::npos) {
+                std::cout << name << " - " << std::flush;
+                throw mc2_exception("No entry by that name in the archive");
+            }
+            which.push_back(i);
+            continue;
+        }
+        std::size_t matched = 0;
+        for (std::size_t i = 0; i < table.size(); ++i) {
+            if (!glob_match(name.c_str(), table[i])) continue;
+            which.push_back(i);
+            ++matched;
+        }
+        if (matched == 0) std::cerr << "WARNING - No entry matches " << name << std::endl;
+    }
+    // Names and globs can overlap; each entry goes to one job, at its first match
+    std::vector<bool> seen(table.size());
+    std::size_t kept = 0;
+    for (std::size_t i : which)
+        if (!seen[i]) seen[i] = true, which[kept++] = i;
+    which.resize(kept);
+    return helper_extract_all(in, table, dir, which, nullptr);
+}
+
+std::size_t extract_archive(const dat_map &in, const std::string &dir) {
+    const name_table table(in.header(), in.files(), in.names());
+    helper_make_dir(dir);
+
+    pack_index index;
+    index.header = in.header();
+    index.names.assign(in.names().begin(), in.names().end());
+    index.records.resize(table.size());
+    std::vector<std::size_t> which(table.size());
+    for (std::size_t i = 0; i < which.size(); ++i) which[i] = i;
+    const std::size_t written = helper_extract_all(in, table, dir, which, &index);
+    index.save(dir + '/' + pack_index::File_Name);
+
+    if (!helper_packs_back(in))
+        std::cerr << "WARNING - The archive is not laid out the way pack lays out archives, so packing it will not give the same bytes" << std::endl;
+    return written;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "span.hpp"
+
+class dat_map;
+
+// Where entry name goes under dir, creating the directories on the way if
+// make_dirs. Throws for a name that would leave dir.
+std::string entry_path(const std::string &dir, span<const char> name, bool make_dirs);
+
+// Writes the named entries, inflated, under dir with their archive paths.
+// A name holding * or ? is a glob over every entry; any other is looked up
+// directly, without touching the rest of the archive. Returns how many
+// entries were written. Entries are inflated across the workers (-jN).
+std::size_t extract_entries(const dat_map &in, const std::string &dir, const std::vector<std::string> &names);
+
+// Writes every entry under dir, along with the pack_index that lets pack
+// make the same archive from it again
+std::size_t extract_archive(const dat_map &in, const std::string &dir);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+struct dat_header { std::uint32_t magic, numFiles, metaLen, nameLen; };
+struct file_info { std::uint32_t nameOffset, dataOffset, decompressLen, compressLen; };
+
+constexpr std::uint32_t MAGIC_DAVE = 0x45564144;
+constexpr std::uint32_t MAGIC_Dave = 0x65766144;
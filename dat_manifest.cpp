@@ -0,0 +1,101 @@
+#include "dat_manifest.hpp"
+
+#include <fstream>
+#include <ios>
+
+#include "xxhash.hpp"
+
+struct manifest_header {
+    std::uint32_t magic, version, numFiles, nameLen;
+    std::uint64_t archiveSize, directoryHash;
+};
+struct manifest_record {
+    file_info file;
+    std::uint64_t hash;
+    std::uint32_t nameLen;
+    std::uint8_t verdict, reserved[3];
+};
+
+constexpr std::uint32_t MAGIC_MANIFEST = 0x4D32434D; // "MC2M"
+
+static std::uint64_t helper_key(const file_info &file) {
+    return (static_cast<std::uint64_t>(file.dataOffset) << 32) | file.compressLen;
+}
+
+bool dat_manifest::load(const std::string &path) {
+    entries.clear(), index.clear();
+    std::ifstream in(path, std::ios_base::in | std::ios_base::binary);
+    if (!in) return false;
+
+    manifest_header header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header))) return false;
+    if (header.magic != MAGIC_MANIFEST || header.version != 1) return false;
+
+    std::vector<manifest_record> records(header.numFiles);
+    std::vector<char> names(header.nameLen);
+    in.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(manifest_record));
+    in.read(names.data(), names.size());
+    if (!in) return false;
+
+    std::size_t nameOffset = 0;
+    entries.reserve(records.size());
+    for (const manifest_record &record : records) {
+        if (record.verdict > static_cast<std::uint8_t>(entry_verdict::patched) ||
+            record.nameLen > names.size() - nameOffset) {
+            entries.clear();
+            return false;
+        }
+        entries.push_back({ record.file, record.hash, static_cast<entry_verdict>(record.verdict),
+                            std::string(names.data() + nameOffset, record.nameLen) });
+        nameOffset += record.nameLen;
+    }
+    archiveSize = header.archiveSize, directoryHash = header.directoryHash;
+    reindex();
+    return true;
+}
+
+void dat_manifest::save(const std::string &path) const {
+    std::vector<manifest_record> records;
+    std::string names;
+    records.reserve(entries.size());
+    for (const manifest_entry &entry : entries) {
+        manifest_record record = { entry.file, entry.hash, static_cast<std::uint32_t>(entry.name.size()),
+                                   static_cast<std::uint8_t>(entry.verdict), { 0, 0, 0 } };
+        records.push_back(record);
+        names += entry.name;
+    }
+    manifest_header header = { MAGIC_MANIFEST, 1, static_cast<std::uint32_t>(records.size()),
+                               static_cast<std::uint32_t>(names.size()), archiveSize, directoryHash };
+
+    std::ofstream out(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(manifest_record));
+    out.write(names.data(), names.size());
+    if (!out) throw std::ios_base::failure("Unable to write manifest");
+}
+
+void dat_manifest::describe(std::uint64_t size, span<const file_info> files) {
+    archiveSize = size;
+    directoryHash = xxhash64(files.data(), files.size() * sizeof(file_info));
+    reindex();
+}
+
+bool dat_manifest::describes(std::uint64_t size, span<const file_info> files) const {
+    return !entries.empty() && entries.size() == files.size() && archiveSize == size &&
+        directoryHash == xxhash64(files.data(), files.size() * sizeof(file_info));
+}
+
+const manifest_entry *dat_manifest::find(const file_info &file, std::uint64_t hash) const {
+    auto it = index.find(helper_key(file));
+    if (it == index.end()) return nullptr;
+    const manifest_entry &entry = entries[it->second];
+    if (entry.hash != hash || entry.file.decompressLen != file.decompressLen) return nullptr;
+    return &entry;
+}
+
+void dat_manifest::reindex() {
+    index.clear();
+    index.reserve(entries.size());
+    for (std::size_t i = 0; i < entries.size(); ++i)
+        if (entries[i].hash != 0) index.emplace(helper_key(entries[i].file), i);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dat_format.hpp"
+#include "span.hpp"
+
+enum class entry_verdict : std::uint8_t { skip, good, patched };
+
+struct manifest_entry {
+    file_info file;     // as stored in the archive the manifest describes
+    std::uint64_t hash; // of the compressed bytes, 0 if they were never read
+    entry_verdict verdict;
+    std::string name;
+};
+
+// Sidecar record of what a previous run found in each entry, so that
+// unchanged textures need not be inflated and checked again.
+class dat_manifest {
+public:
+    std::vector<manifest_entry> entries;
+    std::uint64_t archiveSize = 0, directoryHash = 0;
+
+    // Returns false, leaving the manifest empty, if it is missing or unreadable
+    bool load(const std::string &path);
+    void save(const std::string &path) const;
+
+    void describe(std::uint64_t size, span<const file_info> files);
+    bool describes(std::uint64_t size, span<const file_info> files) const;
+
+    // An entry with the same data and a verdict from a previous run, or nullptr
+    const manifest_entry *find(const file_info &file, std::uint64_t hash) const;
+
+private:
+    std::unordered_map<std::uint64_t, std::size_t> index;
+    void reindex();
+};
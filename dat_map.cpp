@@ -0,0 +1,95 @@
+#include "dat_map.hpp"
+
+#include <ios>
+
+#include "mc2_exception.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+dat_map::dat_map(const std::string &path) {
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) throw std::ios_base::failure("Unable to open archive");
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        CloseHandle(file);
+        throw std::ios_base::failure("Unable to read archive size");
+    }
+    length = static_cast<std::size_t>(fileSize.QuadPart);
+    if (length < sizeof(dat_header)) {
+        CloseHandle(file);
+        throw mc2_exception("DAT file too small to contain a header");
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping != nullptr) base = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (base == nullptr) {
+        if (mapping != nullptr) CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::ios_base::failure("Unable to map archive into memory");
+    }
+}
+
+dat_map::~dat_map() {
+    UnmapViewOfFile(base);
+    CloseHandle(mapping);
+    CloseHandle(file);
+}
+
+#else
+
+dat_map::dat_map(const std::string &path) {
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::ios_base::failure("Unable to open archive");
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::ios_base::failure("Unable to read archive size");
+    }
+    length = static_cast<std::size_t>(st.st_size);
+    if (length < sizeof(dat_header)) {
+        close(fd);
+        throw mc2_exception("DAT file too small to contain a header");
+    }
+    // The descriptor stays open for kernel-side copies out of the archive
+    void *addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        close(fd);
+        throw std::ios_base::failure("Unable to map archive into memory");
+    }
+    base = static_cast<const char *>(addr);
+}
+
+dat_map::~dat_map() {
+    munmap(const_cast<char *>(base), length);
+    close(fd);
+}
+
+#endif
+
+span<const file_info> dat_map::files() const {
+    const std::size_t count = header().numFiles;
+    if (length < 2048 || (length - 2048) / sizeof(file_info) < count)
+        throw mc2_exception("DAT file too small for its File Directory");
+    return { reinterpret_cast<const file_info *>(base + 2048), count };
+}
+
+span<const std::uint8_t> dat_map::names() const {
+    const std::uint64_t start = 2048 + static_cast<std::uint64_t>(header().metaLen);
+    if (start + header().nameLen > length) throw mc2_exception("DAT file too small for its Name Table");
+    return { reinterpret_cast<const std::uint8_t *>(base + start), header().nameLen };
+}
+
+span<const char> dat_map::payload(const file_info &file) const {
+    if (static_cast<std::uint64_t>(file.dataOffset) + file.compressLen > length)
+        throw mc2_exception("File data extends past the end of the DAT file");
+    return { base + file.dataOffset, file.compressLen };
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+
+#include "dat_format.hpp"
+#include "span.hpp"
+
+// Read-only memory mapping of a whole DAT archive.
+// All spans point straight into the mapping and stay valid for its lifetime.
+class dat_map {
+public:
+    explicit dat_map(const std::string &path);
+    ~dat_map();
+
+    dat_map(const dat_map &) = delete;
+    dat_map &operator=(const dat_map &) = delete;
+
+    std::size_t size() const { return length; }
+    span<const char> bytes() const { return { base, length }; }
+
+    const dat_header &header() const { return *reinterpret_cast<const dat_header *>(base); }
+    span<const file_info> files() const;
+    span<const std::uint8_t> names() const;
+    span<const char> payload(const file_info &file) const;
+
+#ifndef _WIN32
+    int descriptor() const { return fd; }
+#endif
+
+private:
+    const char *base = nullptr;
+    std::size_t length = 0;
+#ifdef _WIN32
+    void *file = nullptr, *mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
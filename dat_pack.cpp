@@ -0,0 +1,269 @@
+#include "dat_pack.hpp"
+
+#include <cstring>
+
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <ios>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <tuple>
+
+#include "dat_batch.hpp"
+#include "dat_extract.hpp"
+#include "dat_proc.hpp"
+#include "dat_writer.hpp"
+#include "mc2_exception.hpp"
+#include "name_table.hpp"
+#include "thread_pool.hpp"
+#include "xxhash.hpp"
+
+struct index_header {
+    std::uint32_t magic, version;
+    dat_header header;
+    std::uint32_t keptLen, reserved;
+};
+
+constexpr std::uint32_t MAGIC_PACK_INDEX = 0x5032434D; // "MC2P"
+
+const char *const pack_index::File_Name = ".mc2dat";
+
+bool pack_index::load(const std::string &path) {
+    std::ifstream in(path, std::ios_base::in | std::ios_base::binary);
+    if (!in) return false;
+
+    index_header head;
+    if (!in.read(reinterpret_cast<char *>(&head), sizeof(head)) || head.magic != MAGIC_PACK_INDEX || head.version != 1)
+        throw std::ios_base::failure("Unreadable pack index " + path);
+    header = head.header;
+    names.resize(header.nameLen);
+    records.resize(header.numFiles);
+    kept.resize(head.keptLen);
+    in.read(reinterpret_cast<char *>(names.data()), names.size());
+    in.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(pack_record));
+    in.read(kept.data(), kept.size());
+    if (!in) throw std::ios_base::failure("Truncated pack index " + path);
+    for (const pack_record &record : records) {
+        if (record.method > pack_method::kept ||
+            (record.method == pack_method::kept &&
+             (record.keptOffset > kept.size() || record.file.compressLen > kept.size() - record.keptOffset)))
+            throw std::ios_base::failure("Corrupt pack index " + path);
+    }
+    return true;
+}
+
+void pack_index::save(const std::string &path) const {
+    const index_header head = { MAGIC_PACK_INDEX, 1, header, static_cast<std::uint32_t>(kept.size()), 0 };
+    std::ofstream out(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    out.write(reinterpret_cast<const char *>(&head), sizeof(head));
+    out.write(reinterpret_cast<const char *>(names.data()), names.size());
+    out.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(pack_record));
+    out.write(kept.data(), kept.size());
+    if (!out) throw std::ios_base::failure("Unable to write pack index " + path);
+}
+
+codec &pack_codec() {
+    static thread_local std::unique_ptr<codec> zlib = make_codec(codec_backend::zlib);
+    return *zlib;
+}
+
+bool find_deflate_params(span<const char> data, span<const char> stream, deflate_params &found) {
+    // Most archives are made with one setting throughout, so the last one
+    // that worked goes first; level 0 never makes a smaller stream
+    static const deflate_params candidates[] = {
+        { 9, 0, 8 }, { 6, 0, 8 }, { 9, 0, 9 }, { 6, 0, 9 }, { 1, 0, 8 }, { 2, 0, 8 }, { 3, 0, 8 }, { 4, 0, 8 },
+        { 5, 0, 8 }, { 7, 0, 8 }, { 8, 0, 8 }, { 1, 0, 9 }, { 2, 0, 9 }, { 3, 0, 9 }, { 4, 0, 9 }, { 5, 0, 9 },
+        { 7, 0, 9 }, { 8, 0, 9 }
+    };
+    constexpr std::size_t count = sizeof(candidates) / sizeof(candidates[0]);
+    static std::atomic<std::size_t> last(0);
+
+    codec &zlib = pack_codec();
+    std::vector<char> out;
+    const std::size_t first = last.load(std::memory_order_relaxed);
+    for (std::size_t k = 0; k < count; ++k) {
+        const std::size_t i = k == 0 ? first : (k <= first ? k - 1 : k);
+        // zlib doesn't always finish in a buffer of exactly the final size
+        if (!zlib.deflate(data, out, stream.size() + 64, candidates[i])) continue;
+        if (out.size() != stream.size() || std::memcmp(out.data(), stream.data(), out.size()) != 0) continue;
+        last.store(i, std::memory_order_relaxed);
+        found = candidates[i];
+        return true;
+    }
+    return false;
+}
+
+static std::vector<char> helper_read_file(const std::string &path) {
+    std::ifstream in(path, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+    if (!in) throw std::ios_base::failure("Unable to open " + path);
+    const std::streamoff size = in.tellg();
+    if (size > static_cast<std::streamoff>(UINT32_MAX)) throw mc2_exception("File too large for a DAT archive");
+    std::vector<char> data(static_cast<std::size_t>(size));
+    in.seekg(0);
+    if (!in.read(data.data(), static_cast<std::streamsize>(data.size()))) throw std::ios_base::failure("Unable to read " + path);
+    return data;
+}
+
+// The stream to store contents as: the way the record says while they are
+// unchanged, otherwise deflated anew unless that doesn't make them smaller.
+// A stored entry stays stored.
+static void helper_payload(const pack_index &index, const pack_record *record, std::vector<char> &contents,
+                           std::vector<char> &payload) {
+    const bool unchanged = record != nullptr && contents.size() == record->file.decompressLen &&
+                           xxhash64(contents.data(), contents.size()) == record->hash;
+    if (record != nullptr && record->method == pack_method::stored) {
+        payload.swap(contents);
+        return;
+    }
+    if (unchanged && record->method == pack_method::kept) {
+        const char *stream = index.kept.data() + record->keptOffset;
+        payload.assign(stream, stream + record->file.compressLen);
+        return;
+    }
+    if (!contents.empty()) {
+        // With room to spare, as zlib may not finish a stream of exactly the limit
+        const std::size_t limit = contents.size() + 64;
+        const bool deflated = record != nullptr && record->method == pack_method::deflated
+            ? pack_codec().deflate(contents, payload, limit, { record->level, 0, record->memLevel })
+            : thread_codec().deflate(contents, payload, limit, { Zlib_Compression_Level });
+        if (deflated && payload.size() < contents.size()) return;
+    }
+    payload.swap(contents);
+}
+
+namespace {
+
+struct pack_entry {
+    std::string name;
+    const pack_record *record; // nullptr without an index
+    file_info file;
+};
+
+// Entries that share one payload in the archive
+struct pack_group {
+    std::vector<std::size_t> entries;
+};
+
+// What a group came to: the entries in it whose files still agree, and
+// any that no longer do, each with its own payload
+struct packed_data {
+    std::vector<std::size_t> entries;
+    std::uint32_t decompressLen;
+    std::vector<char> payload;
+};
+
+}
+
+static std::vector<packed_data> helper_pack_group(const std::string &dir, const pack_index &index,
+                                                  const std::vector<pack_entry> &entries, const pack_group &group) {
+    std::vector<packed_data> out;
+    std::vector<char> first;
+    for (const std::size_t i : group.entries) {
+        const pack_entry &entry = entries[i];
+        std::vector<char> contents = helper_read_file(entry_path(dir, span<const char>(entry.name.data(), entry.name.size()), false));
+        if (!out.empty() && contents == first) {
+            out.front().entries.push_back(i);
+            continue;
+        }
+        if (out.empty()) first = contents;
+        out.emplace_back();
+        packed_data &data = out.back();
+        data.entries.push_back(i);
+        data.decompressLen = static_cast<std::uint32_t>(contents.size());
+        helper_payload(index, entry.record, contents, data.payload);
+    }
+    return out;
+}
+
+std::size_t pack_archive(const std::string &dir, const std::string &dat_name, bool plain_names) {
+    pack_index index;
+    const bool indexed = index.load(dir + '/' + pack_index::File_Name);
+
+    dat_header header;
+    std::vector<pack_entry> entries;
+    std::vector<pack_group> groups;
+    if (indexed) {
+        header = index.header;
+        std::vector<file_info> files;
+        for (const pack_record &record : index.records) files.push_back(record.file);
+        const name_table table(header, files, index.names);
+        // Entries sharing their data in the archive share it again, in the order it was laid out
+        std::map<std::tuple<std::uint32_t, std::uint32_t, std::uint32_t>, std::size_t> shared;
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            entries.push_back({ std::string(table[i].data(), table[i].size()), &index.records[i], files[i] });
+            const auto key = std::make_tuple(files[i].dataOffset, files[i].compressLen, files[i].decompressLen);
+            const auto group = shared.emplace(key, shared.size());
+            if (group.second) groups.emplace_back();
+            groups[group.first->second].entries.push_back(i);
+        }
+        std::vector<pack_group> ordered;
+        ordered.reserve(groups.size());
+        for (const auto &group : shared) ordered.push_back(std::move(groups[group.second]));
+        groups.swap(ordered);
+    } else {
+        std::vector<std::string> names;
+        for (std::string &name : find_files(dir))
+            if (name != pack_index::File_Name) names.push_back(std::move(name));
+        std::vector<std::uint32_t> offsets;
+        index.names = encode_names(names, !plain_names, offsets);
+        if (names.size() > (UINT32_MAX - 2048) / sizeof(file_info)) throw mc2_exception("Too many files for a DAT archive");
+        header.magic = plain_names ? MAGIC_DAVE : MAGIC_Dave;
+        header.numFiles = static_cast<std::uint32_t>(names.size());
+        header.metaLen = (header.numFiles * sizeof(file_info) + 2047) & ~2047u;
+        header.nameLen = static_cast<std::uint32_t>(index.names.size());
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            file_info file = { offsets[i], 0, 0, 0 };
+            entries.push_back({ std::move(names[i]), nullptr, file });
+            groups.push_back({ { i } });
+        }
+    }
+
+    file_writer out(dat_name);
+    out.seek(0);
+    out.write({ reinterpret_cast<const char *>(&header), sizeof(header) });
+    out.seek(2048 + header.metaLen);
+    out.write({ reinterpret_cast<const char *>(index.names.data()), index.names.size() });
+    out.seek(2048 + static_cast<std::uint64_t>(header.metaLen) + header.nameLen);
+
+    // Declared before the pool so that the workers are joined first
+    std::deque<std::future<std::vector<packed_data>>> pending;
+    thread_pool pool(Worker_Threads > 0 ? static_cast<unsigned>(Worker_Threads) : 0);
+    const std::size_t window = 2 * static_cast<std::size_t>(pool.size());
+    const auto commit_front = [&]() {
+        for (const packed_data &data : pending.front().get()) {
+            if (out.tell() + data.payload.size() > UINT32_MAX) throw mc2_exception("Archive would be larger than 4 GiB");
+            const std::uint32_t offset = seek_pad(out, data.payload.size());
+            out.write(data.payload);
+            for (const std::size_t i : data.entries) {
+                file_info &file = entries[i].file;
+                file.dataOffset = offset;
+                file.decompressLen = data.decompressLen;
+                file.compressLen = static_cast<std::uint32_t>(data.payload.size());
+                if (!Quiet_Output) std::cout << entries[i].name << " - " << data.payload.size() << " bytes" << std::endl;
+            }
+        }
+        pending.pop_front();
+    };
+    for (const pack_group &group : groups) {
+        const pack_group *job = &group;
+        pending.push_back(pool.submit([&dir, &index, &entries, job]() { return helper_pack_group(dir, index, entries, *job); }));
+        while (pending.size() > window) commit_front();
+    }
+    while (!pending.empty()) commit_front();
+
+    // pad end of file
+    const std::uint64_t end = (out.tell() + 2047) & ~static_cast<std::uint64_t>(2047);
+    out.seek(end - 1);
+    out.write({ "", 1 });
+
+    std::vector<file_info> files;
+    files.reserve(entries.size());
+    for (const pack_entry &entry : entries) files.push_back(entry.file);
+    out.seek(2048);
+    out.write({ reinterpret_cast<const char *>(files.data()), files.size() * sizeof(file_info) });
+    out.flush();
+    return entries.size();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+#include "codec.hpp"
+#include "dat_format.hpp"
+
+// How an entry was stored in the archive it was extracted from
+enum class pack_method : std::uint8_t {
+    stored,   // as is
+    deflated, // by plain zlib at level and memLevel, which give the same stream again
+    kept      // by something else; the stream is kept in the index
+};
+
+struct pack_record {
+    file_info file;     // as stored in the extracted archive
+    std::uint64_t hash; // of the extracted contents
+    pack_method method;
+    std::uint8_t level, memLevel, reserved;
+    std::uint32_t keptOffset; // of a kept stream in pack_index::kept
+};
+
+// Sidecar that extract leaves in the output directory: the header, name
+// table and layout of the archive and how each entry was compressed. pack
+// builds the same archive from a directory that has one, byte for byte
+// while the files are unchanged.
+class pack_index {
+public:
+    static const char *const File_Name;
+
+    dat_header header;
+    std::vector<std::uint8_t> names;
+    std::vector<pack_record> records;
+    std::vector<char> kept;
+
+    // Returns false if there is none; throws if it is unreadable
+    bool load(const std::string &path);
+    void save(const std::string &path) const;
+};
+
+// Plain zlib, whatever --codec says, since the index records zlib settings
+codec &pack_codec();
+
+// Finds the zlib settings that deflate data into exactly stream, trying the
+// ones that last worked first. False if none of them does.
+bool find_deflate_params(span<const char> data, span<const char> stream, deflate_params &found);
+
+// Packs the files under dir into a new archive. With an index from extract
+// its entries are laid out as they were; otherwise every file goes in, in
+// name order, with a Base64 name table unless plain_names. Returns how many
+// entries were written.
+std::size_t pack_archive(const std::string &dir, const std::string &dat_name, bool plain_names);
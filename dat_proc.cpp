@@ -2,39 +2,64 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 #include <zlib.h>
 
+#include "codec.hpp"
+#include "dat_format.hpp"
+#include "dat_manifest.hpp"
+#include "dat_map.hpp"
+#include "dat_reader.hpp"
+#include "dat_stats.hpp"
+#include "dat_writer.hpp"
+#include "deflate_search.hpp"
+#include "deflate_splice.hpp"
+#include "dxt_verify.hpp"
+#include "entry_job.hpp"
 #include "fix_dxt.hpp"
+#include "fix_stream.hpp"
+#include "io_ring.hpp"
 #include "mc2_exception.hpp"
-
-class zlib_exception : public std::exception {
-public:
-    zlib_exception(int err, z_stream *strm) {
-        std::stringstream out(msg);
-        out << "Zlib error " << err << ": " << strm->msg;
-    }
-    virtual const char *what() const noexcept override { return msg.c_str(); }
-
-private:
-    std::string msg;
-};
-
-struct dat_header { std::uint32_t magic, numFiles, metaLen, nameLen; };
-struct file_info { std::uint32_t nameOffset, dataOffset, decompressLen, compressLen; };
-
-constexpr std::uint32_t MAGIC_DAVE = 0x45564144;
-constexpr std::uint32_t MAGIC_Dave = 0x65766144;
-
-constexpr char chartable[65] = "\0 #$()-./?0123456789_abcdefghijklmnopqrstuvwxyz~++++++++++++++++";
+#include "name_table.hpp"
+#include "solver_counters.hpp"
+#include "span.hpp"
+#include "thread_pool.hpp"
+#include "xxhash.hpp"
 
 int Zlib_Compression_Level = Z_DEFAULT_COMPRESSION;
+int Worker_Threads = 0;
+bool Optimize_Compression = false;
+unsigned Exhaustive_Budget = 0;
+bool Quiet_Output = false;
+std::size_t Texture_Window = 256 << 10;
+bool Splice_Deflate = false;
+bool Dedup_Entries = false;
+bool Solver_Stats = false;
+bool Verify_Textures = false;
+name_filter Name_Filter;
+thread_pool *Shared_Pool = nullptr;
+thread_pool *Search_Pool = nullptr;
+thread_local archive_tally *Archive_Tally = nullptr;
 
 template<class T> static void helper_read_at(std::istream &in, const std::streampos pos, T &t) {
     in.seekg(pos);
@@ -46,131 +71,433 @@ template<class T> static void helper_read_at(std::istream &in, const std::stream
     in.read(reinterpret_cast<std::istream::char_type *>(v.data()), v.size() * sizeof(T));
 }
 
-template<class T> static void helper_write_at(std::ostream &out, const std::streampos pos, const T &t) {
-    out.seekp(pos);
-    out.write(reinterpret_cast<const std::ostream::char_type *>(&t), sizeof(T));
+template<class T> static void helper_write_at(dat_writer &out, const std::uint64_t pos, span<const T> v) {
+    stat_add(&dat_stats::bytesWritten, v.size() * sizeof(T));
+    out.seek(pos);
+    out.write({ reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T) });
+}
+
+template<class T> static void helper_write_at(dat_writer &out, const std::uint64_t pos, const std::vector<T> &v) {
+    helper_write_at(out, pos, span<const T>(v));
 }
 
-template<class T> static void helper_write_at(std::ostream &out, const std::streampos pos, const std::vector<T> &v) {
-    out.seekp(pos);
-    out.write(reinterpret_cast<const std::ostream::char_type *>(v.data()), v.size() * sizeof(T));
+template<class T> static void helper_write_at(dat_writer &out, const std::uint64_t pos, const T &t) {
+    helper_write_at(out, pos, span<const T>(&t, 1));
 }
 
-template<class T> static std::uint32_t helper_write_pad(std::ostream &out, const std::vector<T> &v) {
-    const size_t padding = (2048 - (out.tellp() % 2048)) % 2048;
-    // Don't pad if data can fit in padding
-    if (v.size() * sizeof(T) > padding) out.seekp(padding, std::ios_base::cur);
-    std::uint32_t output = static_cast<std::uint32_t>(out.tellp());
-    out.write(reinterpret_cast<const std::ostream::char_type *>(v.data()), v.size() * sizeof(T));
+template<class T> static std::uint32_t helper_write_pad(dat_writer &out, span<const T> v) {
+    std::uint32_t output = seek_pad(out, v.size() * sizeof(T));
+    stat_add(&dat_stats::bytesWritten, v.size() * sizeof(T));
+    out.write({ reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T) });
     return output;
 }
 
-static bool decompress(const std::vector<char> &compressed, std::vector<char> &decompressed) {
+// blocks, if given, gets the block starts of compressed for deflate_splice
+static bool decompress(span<const char> compressed, std::vector<char> &decompressed, std::vector<deflate_block> *blocks) {
     if (decompressed.size() < FixingSize) return false;
 
-    int ret;
-    z_stream strm;
-
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    ret = inflateInit2(&strm, -MAX_WBITS);
-    if (ret != Z_OK) throw zlib_exception(ret, &strm);
-
-    strm.avail_in = static_cast<uInt>(compressed.size());
-    strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(compressed.data()));
-    strm.avail_out = static_cast<uInt>(FixingSize);
-    strm.next_out = reinterpret_cast<Bytef *>(decompressed.data());
-
-    ret = inflate(&strm, Z_SYNC_FLUSH);
-    if (ret != Z_OK && ret != Z_STREAM_END) throw zlib_exception(ret, &strm);;
-    if (strm.avail_out != 0) throw mc2_exception("Unable to decompress Tex header");
-    if (ret == Z_STREAM_END || !needs_fixing(decompressed)) {
-        ret = inflateEnd(&strm);
-        if (ret != Z_OK) throw zlib_exception(ret, &strm);;
-        return false;
-    }
-
-    strm.avail_out = static_cast<uInt>(decompressed.size() - FixingSize);
-    ret = inflate(&strm, Z_FINISH);
-    if (ret != Z_STREAM_END) throw zlib_exception(ret, &strm);;
-    if (strm.avail_out != 0) throw mc2_exception("Decompressed size incorrect");
-    if (strm.avail_in != 0) throw mc2_exception("Compressed size incorrect");
+    stage_timer timer(stat_stage::inflate);
+    codec &engine = thread_codec();
+    if (!engine.inflate_prefix(compressed, span<char>(decompressed.data(), FixingSize))) return false;
+    if (!needs_fixing(decompressed)) return false;
 
-    /* clean up and return */
-    ret = inflateEnd(&strm);
-    if (ret != Z_OK) throw zlib_exception(ret, &strm);;
+    if (blocks != nullptr) inflate_blocks(compressed, decompressed, *blocks);
+    else engine.inflate(compressed, decompressed);
+    stat_add(&dat_stats::bytesInflated, decompressed.size());
     return true;
 }
 
 static bool compress(const std::vector<char> &decompressed, std::vector<char> &compressed) {
-    int ret;
-    z_stream strm;
-
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    ret = deflateInit2(&strm, Zlib_Compression_Level, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
-    if (ret != Z_OK) throw zlib_exception(ret, &strm);;
-
-    /* compress until end of file */
-    strm.avail_in = static_cast<uInt>(decompressed.size());
-    strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(decompressed.data()));
-    strm.avail_out = static_cast<uInt>(compressed.size());
-    strm.next_out = reinterpret_cast<Bytef *>(compressed.data());
-
-    ret = deflate(&strm, Z_FINISH);    /* no bad return value */
-    if (ret == Z_OK) {
-        // compression increases file size, so abort it
-        ret = deflateEnd(&strm);
-        if (ret != Z_OK) throw zlib_exception(ret, &strm);;
-        return false;
+    // compression must make the texture smaller to be worth it
+    return thread_codec().deflate(decompressed, compressed, decompressed.size() - 1, { Zlib_Compression_Level });
+}
+
+bool is_texture_name(span<const char> name) {
+    return name.size() >= 4 && std::memcmp(name.data() + name.size() - 4, ".tex", 4) == 0;
+}
+
+// Header check of decompress, without inflating the rest
+static bool helper_needs_fixing(const entry_job &job) {
+    if (job.file.compressLen == job.file.decompressLen) return needs_fixing(job.payload);
+    if (job.file.decompressLen < FixingSize) return false;
+    stage_timer timer(stat_stage::inflate);
+    char header[FixingSize];
+    if (!thread_codec().inflate_prefix(job.payload, span<char>(header, FixingSize))) return false;
+    return needs_fixing({ header, FixingSize });
+}
+
+// Big textures are fixed a window at a time, unless --optimize or --splice
+// need the whole of them, or another backend would give different bytes than zlib
+static bool helper_streamed(const entry_job &job) {
+    return Texture_Window != 0 && job.search == nullptr && !Splice_Deflate && Codec_Backend == codec_backend::zlib &&
+           job.file.decompressLen > 4 * static_cast<std::uint64_t>(Texture_Window);
+}
+
+void process_texture(entry_job &job) {
+#ifdef MC2_SOLVER_COUNTERS
+    // The fix counts to the job from this thread; helpers sharing it add theirs
+    struct count_scope {
+        explicit count_scope(solver_counters *counts) { Solver_Counts = counts; }
+        ~count_scope() { Solver_Counts = nullptr; }
+    } counting(Solver_Stats ? &job.solver : nullptr);
+#endif
+    file_info &file = job.file;
+    std::vector<char> &outputBuffer = job.buffer;
+
+    // Loaded payloads sit in job.data, which streamed and spliced textures
+    // are written to while the payload is still read
+    std::vector<char> input;
+    if (helper_streamed(job) && helper_needs_fixing(job)) {
+        job.checked = true;
+        if (job.payload.data() == job.data.data()) input.swap(job.data);
+        switch (fix_dxt_streaming(job.payload, file, Zlib_Compression_Level, Texture_Window, job.buffer, job.data,
+                                  job.helpers, Verify_Textures ? &job.verify : nullptr)) {
+            case stream_fix::unchanged: return;
+            case stream_fix::patched:
+                job.payload = job.data;
+                job.patched = true;
+                if (job.cache != nullptr) job.hash = xxhash64(job.payload.data(), job.payload.size());
+                return;
+            case stream_fix::incompressible: // stored uncompressed, which needs all of it in memory
+                job.verify = texture_error();
+                break;
+        }
     }
-    if (ret != Z_STREAM_END) throw zlib_exception(ret, &strm);;
-    if (strm.avail_in != 0) throw mc2_exception("Texture not completely compressed?");
-    compressed.resize(compressed.size() - strm.avail_out);
 
-    ret = deflateEnd(&strm);
-    if (ret != Z_OK) throw zlib_exception(ret, &strm);;
-    return true;
+    // --optimize searches from scratch, so only plain deflates are spliced
+    thread_local std::vector<deflate_block> blocks;
+    const bool splice = Splice_Deflate && job.search == nullptr && file.compressLen < file.decompressLen;
+
+    bool fix;
+    if (file.compressLen < file.decompressLen) {
+        outputBuffer.resize(file.decompressLen);
+        fix = decompress(job.payload, outputBuffer, splice ? &blocks : nullptr);
+    } else if (file.compressLen == file.decompressLen) {
+        // Stored textures are only copied out of the payload when they need fixing
+        fix = needs_fixing(job.payload);
+        if (fix) outputBuffer.assign(job.payload.begin(), job.payload.end());
+    } else throw mc2_exception("Compressed texture larger than decompressed is invalid");
+
+    if (fix) {
+        job.checked = true;
+        bool modified;
+        std::size_t first = 0;
+        {
+            stage_timer timer(stat_stage::fix);
+            thread_local std::vector<char> original;
+            if (Verify_Textures) original = outputBuffer;
+            modified = fix_dxt(outputBuffer, &first, job.helpers);
+            if (modified && Verify_Textures) verify_texture(original, outputBuffer, job.verify);
+        }
+        if (modified) {
+            std::vector<char> &compressBuffer = job.data;
+            file.decompressLen = static_cast<uint32_t>(outputBuffer.size());
+            stage_timer timer(stat_stage::deflate);
+            bool smaller;
+            if (splice) {
+                if (job.payload.data() == job.data.data()) input.swap(job.data);
+                smaller = deflate_splice(job.payload, blocks, outputBuffer, first, compressBuffer, outputBuffer.size() - 1,
+                                         Zlib_Compression_Level);
+            } else if (job.search != nullptr) {
+                stat_add(&dat_stats::bytesDeflated, outputBuffer.size());
+                smaller = deflate_smallest(*job.search, outputBuffer, compressBuffer, outputBuffer.size() - 1,
+                                           { Zlib_Compression_Level }, Exhaustive_Budget, job.baseline);
+            } else {
+                stat_add(&dat_stats::bytesDeflated, outputBuffer.size());
+                smaller = compress(outputBuffer, compressBuffer);
+            }
+            if (!smaller) std::swap(outputBuffer, compressBuffer);
+            file.compressLen = static_cast<uint32_t>(compressBuffer.size());
+            job.payload = compressBuffer;
+            job.patched = true;
+            if (job.cache != nullptr) job.hash = xxhash64(job.payload.data(), job.payload.size());
+        }
+    }
 }
 
-static std::uint8_t helper_getBase64(const std::vector<std::uint8_t> &n, const std::uint32_t l, const std::uint32_t i) {
-    const size_t k = i / 4;
-    switch (i & 0x3) {
-        case 0: return ((n[l + 3*k + 0] & 0x3F) << 0)                        ; break;
-        case 1: return ((n[l + 3*k + 1] & 0x0F) << 2) | (n[l + 3*k + 0] >> 6); break;
-        case 2: return ((n[l + 3*k + 2] & 0x03) << 4) | (n[l + 3*k + 1] >> 4); break;
-        case 3: return                                  (n[l + 3*k + 2] >> 2); break;
-        default: return -1; // Won't ever happen
+// Whether the entry is a texture to be checked at all
+static bool helper_selected(const entry_job &job) {
+    return is_texture_name(job.name) && (Name_Filter.empty() || Name_Filter.selects(job.name));
+}
+
+static void process_entry(entry_job &job) {
+    if (job.same_as != nullptr || !helper_selected(job)) return;
+    if (job.cache != nullptr) {
+        job.hash = xxhash64(job.payload.data(), job.payload.size());
+        job.cached = job.cache->find(job.file, job.hash);
+        if (job.cached != nullptr) return;
+    }
+    process_texture(job);
+}
+
+typedef std::function<void(entry_job &)> entry_fn;
+
+static void helper_commit(entry_job &job, std::future<void> &done, const entry_fn &commit) {
+    try {
+        done.get();
+    } catch (...) {
+        if (job.checked) std::cout.write(job.name.data(), job.name.size()) << " - " << std::flush;
+        throw;
     }
+    if (job.checked && !Quiet_Output) std::cout.write(job.name.data(), job.name.size()) << " - " << (job.patched ? "Patched" : "Good") << std::endl;
+    stage_timer timer(stat_stage::write);
+    commit(job);
+}
+
+static bool helper_is_base64(const dat_header &header) {
+    if (header.magic == MAGIC_DAVE) return false;
+    else if (header.magic == MAGIC_Dave) return true;
+    else throw mc2_exception("Unknown DAT file format. Maybe a ZIP file?");
+}
+
+static std::size_t helper_sectors(std::size_t size) {
+    return (size + 2047) / 2048;
+}
+
+static entry_verdict helper_verdict(const entry_job &job) {
+    if (job.cached != nullptr) return job.cached->verdict;
+    return job.patched ? entry_verdict::patched : job.checked ? entry_verdict::good : entry_verdict::skip;
 }
 
-static std::string helper_decode64(const std::vector<std::uint8_t> &names, std::vector<char> &nameBuffer, file_info file) {
-    uint32_t i = 0;
-    {
-        /*
-        * Apparent Delta Encoding Scheme:
-        * First:  111 CBA
-        * Second: 10G FED
-        *
-        * The total number of characters to keep
-        * is the binary value 0GFE DCBA
-        */
-        std::uint8_t v = helper_getBase64(names, file.nameOffset, 0);
-        if (v >= 0x30) {
-            std::uint8_t t = helper_getBase64(names, file.nameOffset, 1);
-            if ((v & 0x78) != 0x38 || (t & 0x70) != 0x20) throw mc2_exception("Invalid Delta Encoding in Base64 DAT");
-            i = 2;
-            nameBuffer.resize((v & 0x07) | ((t & 0x0F) << 3));
-        } else nameBuffer.clear();
+// load fills in the payload of each entry and commit consumes the result,
+// both called on this thread in directory order, or in order if given.
+// The inflate / fix_dxt / deflate work in between runs on the pool.
+// Entries found unchanged in manifest are passed through; the manifest
+// is then replaced by a record of the entries as committed.
+static void process_entries(const dat_header &header, std::vector<file_info> &files, span<const std::uint8_t> names,
+                            const entry_fn &load, const entry_fn &commit, dat_manifest *manifest,
+                            const std::vector<std::uint32_t> *order = nullptr) {
+    const name_table table(header, files, names);
+    std::vector<manifest_entry> records;
+    std::size_t unchanged = 0;
+    std::size_t optimized = 0, bytesSaved = 0, sectorsSaved = 0;
+#ifdef MC2_SOLVER_COUNTERS
+    solver_report solver;
+#endif
+    verify_report verified;
+    const entry_fn record = [&](entry_job &job) {
+        commit(job);
+        if (Verify_Textures && !job.verify.empty()) {
+            verified.add(std::string(job.name.begin(), job.name.end()), job.verify);
+            if (!Quiet_Output) {
+                std::cout << "  verify: ";
+                job.verify.print_line(std::cout);
+                std::cout << std::endl;
+            }
+        }
+#ifdef MC2_SOLVER_COUNTERS
+        if (Solver_Stats && !job.solver.empty()) {
+            solver.add(std::string(job.name.begin(), job.name.end()), job.solver);
+            if (!Quiet_Output) {
+                std::cout << "  solver: ";
+                job.solver.print_line(std::cout);
+                std::cout << std::endl;
+            }
+        }
+#endif
+        // Entries the manifest passed through were checked by an earlier
+        // run; their stored verdict only goes back into the manifest
+        if (Archive_Tally != nullptr) {
+            if (job.cached != nullptr) ++Archive_Tally->unchanged;
+            else switch (helper_verdict(job)) {
+                case entry_verdict::skip: ++Archive_Tally->skipped; break;
+                case entry_verdict::good: ++Archive_Tally->good; break;
+                case entry_verdict::patched: ++Archive_Tally->patched; break;
+            }
+        }
+        if (Run_Stats != nullptr) {
+            if (job.cached != nullptr) ++Run_Stats->unchanged;
+            else switch (helper_verdict(job)) {
+                case entry_verdict::skip: ++Run_Stats->skipped; break;
+                case entry_verdict::good: ++Run_Stats->good; break;
+                case entry_verdict::patched: ++Run_Stats->patched; break;
+            }
+        }
+        if (job.search != nullptr && job.patched) {
+            const std::size_t plain = job.baseline != 0 ? job.baseline : job.file.decompressLen;
+            if (job.payload.size() < plain) ++optimized;
+            bytesSaved += plain - job.payload.size();
+            sectorsSaved += helper_sectors(plain) - helper_sectors(job.payload.size());
+        }
+        if (manifest == nullptr) return;
+        records.push_back({ job.file, job.hash, helper_verdict(job), std::string(job.name.begin(), job.name.end()) });
+        if (job.cached != nullptr) ++unchanged;
+    };
+
+    // Buffers of committed entries, handed to new ones instead of reallocating
+    std::vector<std::vector<char>> spare;
+    const auto reuse = [&spare](std::vector<char> &buffer) {
+        if (spare.empty()) return;
+        buffer.swap(spare.back());
+        spare.pop_back();
+    };
+    const auto commit_front = [&](std::deque<std::pair<std::unique_ptr<entry_job>, std::future<void>>> &pending) {
+        entry_job &job = *pending.front().first;
+        helper_commit(job, pending.front().second, record);
+        spare.push_back(std::move(job.data));
+        spare.push_back(std::move(job.buffer));
+        pending.pop_front();
+    };
+
+    // Declared before the pools so that the workers are joined first
+    std::deque<std::pair<std::unique_ptr<entry_job>, std::future<void>>> pending;
+    const unsigned threads = Worker_Threads > 0 ? static_cast<unsigned>(Worker_Threads) : 0;
+    // Entry jobs wait on the candidates, so those get a pool of their own
+    std::unique_ptr<thread_pool> ownSearch;
+    if (Optimize_Compression && Search_Pool == nullptr) ownSearch.reset(new thread_pool(threads));
+    thread_pool *search = ownSearch ? ownSearch.get() : Optimize_Compression ? Search_Pool : nullptr;
+    std::unique_ptr<thread_pool> own;
+    if (Shared_Pool == nullptr) own.reset(new thread_pool(threads));
+    thread_pool &pool = own ? *own : *Shared_Pool;
+    const size_t window = 2 * static_cast<size_t>(pool.size());
+
+    const std::size_t count = order != nullptr ? order->size() : files.size();
+
+    // A shared pool outlives this call, so on an error the jobs already
+    // handed to it must finish before their entries go away
+    struct drain_on_error {
+        std::deque<std::pair<std::unique_ptr<entry_job>, std::future<void>>> &pending;
+        bool shared;
+        ~drain_on_error() {
+            if (!shared) return;
+            for (auto &entry : pending)
+                if (entry.second.valid()) entry.second.wait();
+        }
+    } drain = { pending, !own };
+
+    for (std::size_t k = 0; k < count; ++k) {
+        const std::size_t i = order != nullptr ? (*order)[k] : k;
+        file_info &file = files[i];
+        std::unique_ptr<entry_job> job(new entry_job(file));
+        reuse(job->data), reuse(job->buffer);
+        job->name = table[i];
+        job->cache = manifest;
+        job->search = search;
+        job->helpers = &pool;
+        {
+            stage_timer timer(stat_stage::read);
+            load(*job);
+        }
+        stat_add(&dat_stats::bytesRead, job->payload.size());
+
+        entry_job &ref = *job;
+        std::future<void> done = pool.submit([&ref]() { process_entry(ref); });
+        pending.emplace_back(std::move(job), std::move(done));
+
+        while (pending.size() > window) commit_front(pending);
+    }
+    while (!pending.empty()) commit_front(pending);
+
+    if (search != nullptr && !Quiet_Output) {
+        std::cout << "--optimize shrank " << optimized << " textures by " << bytesSaved << " bytes, "
+                  << sectorsSaved << " sectors of 2048 bytes" << std::endl;
     }
-    char c;
-    do {
-        std::uint8_t v = helper_getBase64(names, file.nameOffset, i++);
-        c = chartable[v];
-        nameBuffer.push_back(c);
-        if (c == '+') throw mc2_exception("Invalid Character in Name for Base64 DAT");
-    } while (c != '\0');
-    return nameBuffer.data();
+    if (Verify_Textures) {
+        std::ostringstream report;
+        verified.print(report);
+        std::cout << report.str() << std::flush;
+    }
+#ifdef MC2_SOLVER_COUNTERS
+    if (Solver_Stats) {
+        // In one write, as archives of a batch finish side by side
+        std::ostringstream report;
+        solver.print(report);
+        std::cout << report.str() << std::flush;
+    }
+#endif
+    if (manifest != nullptr) {
+        manifest->entries.swap(records);
+        if (!Quiet_Output) std::cout << unchanged << " textures unchanged since the last run" << std::endl;
+    }
+}
+
+// Identifies a payload by content for --dedup: two 64-bit hashes and its sizes
+typedef std::tuple<std::uint64_t, std::uint64_t, std::uint32_t, std::uint32_t> content_key;
+
+static content_key helper_content_key(span<const char> payload, const file_info &file) {
+    return content_key(xxhash64(payload.data(), payload.size()), xxhash64(payload.data(), payload.size(), 0x9E3779B97F4A7C15),
+                       file.compressLen, file.decompressLen);
+}
+
+static void process_archive(dat_writer &out, const dat_header &header, std::vector<file_info> &files,
+                            span<const std::uint8_t> names, const entry_fn &load, dat_manifest *manifest,
+                            const std::vector<std::uint32_t> *order = nullptr) {
+    helper_is_base64(header);
+    helper_write_at(out, 0, header);
+    helper_write_at(out, 2048 + header.metaLen, names);
+
+    // --dedup: the first entry loaded with each payload (and selection), the
+    // outcome of those, and where each distinct payload was written
+    struct first_result {
+        bool checked, patched;
+        std::uint64_t hash;
+    };
+    std::map<std::pair<content_key, bool>, const file_info *> loaded;
+    std::map<const file_info *, first_result> results;
+    std::map<content_key, std::uint32_t> written;
+    std::size_t shared = 0;
+    std::uint64_t sharedBytes = 0;
+
+    const entry_fn load_shared = [&](entry_job &job) {
+        load(job);
+        if (!Dedup_Entries) return;
+        const auto key = std::make_pair(helper_content_key(job.payload, job.file), helper_selected(job));
+        const auto first = loaded.emplace(key, &job.file);
+        if (first.second) return;
+        // A copy of an entry still being worked on; it takes that one's result
+        job.same_as = first.first->second;
+        job.search = nullptr;
+    };
+
+    out.seek(2048 + static_cast<std::uint64_t>(header.metaLen) + header.nameLen);
+    process_entries(header, files, names, load_shared, [&](entry_job &job) {
+        if (job.same_as != nullptr) {
+            // Committed in order, so the first one already has its final data
+            const first_result &first = results.at(job.same_as);
+            job.file.dataOffset = job.same_as->dataOffset;
+            job.file.compressLen = job.same_as->compressLen;
+            job.file.decompressLen = job.same_as->decompressLen;
+            job.checked = first.checked, job.patched = first.patched, job.hash = first.hash;
+            if (job.checked && !Quiet_Output)
+                std::cout.write(job.name.data(), job.name.size()) << " - " << (job.patched ? "Patched" : "Good") << " (shared)" << std::endl;
+            ++shared, sharedBytes += job.file.compressLen;
+            return;
+        }
+        content_key key;
+        if (Dedup_Entries) {
+            results.emplace(&job.file, first_result{ job.checked, job.patched, job.hash });
+            key = helper_content_key(job.payload, job.file);
+            const auto found = written.find(key);
+            if (found != written.end()) {
+                job.file.dataOffset = found->second;
+                ++shared, sharedBytes += job.payload.size();
+                return;
+            }
+        }
+        if (job.patched) {
+            job.file.dataOffset = helper_write_pad(out, job.payload);
+        } else {
+            const std::uint32_t source = job.file.dataOffset;
+            job.file.dataOffset = seek_pad(out, job.payload.size());
+            out.copy(job.payload, source);
+            stat_add(&dat_stats::bytesWritten, job.payload.size());
+        }
+        if (Dedup_Entries) written.emplace(key, job.file.dataOffset);
+    }, manifest, order);
+    if (Dedup_Entries && !Quiet_Output)
+        std::cout << "--dedup shared the data of " << shared << " entries, " << sharedBytes << " bytes" << std::endl;
+    
+    // pad end of file
+    const std::uint64_t end = (out.tell() + 2047) & ~static_cast<std::uint64_t>(2047);
+    stat_add(&dat_stats::paddingBytes, end - out.tell());
+    out.seek(end - 1);
+    out.write({ "", 1 });
+    if (manifest != nullptr) manifest->describe(out.tell(), files);
+    
+    // write file directory
+    if (!Quiet_Output) std::cout << "Writing new File Directory" << std::endl;
+    helper_write_at(out, 2048, files);
+    out.flush();
 }
 
 void process_textures(std::istream &in, std::ostream &out) {
@@ -180,70 +507,317 @@ void process_textures(std::istream &in, std::ostream &out) {
 
     dat_header header;
     helper_read_at(in, 0, header);
-    helper_write_at(out, 0, header);
-    
-    bool isBase64;
-    if (header.magic == MAGIC_DAVE) isBase64 = false;
-    else if (header.magic == MAGIC_Dave) isBase64 = true;
-    else throw mc2_exception("Unknown DAT file format. Maybe a ZIP file?");
+    helper_is_base64(header);
     
     std::vector<file_info> files(header.numFiles);
     helper_read_at(in, 2048, files);
     
     std::vector<std::uint8_t> names(header.nameLen);
     helper_read_at(in, 2048 + header.metaLen, names);
-    helper_write_at(out, 2048 + header.metaLen, names);
-    
-    std::vector<char> nameBuffer;
-    std::vector<char> outputBuffer;
-    std::vector<char> compressBuffer;
-    
-    out.seekp(2048 + header.metaLen + header.nameLen);
-    for (file_info &file : files) {
-        std::string name;
-        if (isBase64) name = helper_decode64(names, nameBuffer, file);
-        else name = (char *) &names[file.nameOffset];
-
-        compressBuffer.resize(file.compressLen);
-        helper_read_at(in, file.dataOffset, compressBuffer);
-
-        // check if file extension is .tex
-        if (name.length() >= 4 && name.compare(name.length() - 4, 4, ".tex") == 0) {
-            bool fix;
-            if (file.compressLen < file.decompressLen) {
-                outputBuffer.resize(file.decompressLen);
-                fix = decompress(compressBuffer, outputBuffer);
-            } else if (file.compressLen == file.decompressLen) {
-                outputBuffer = compressBuffer;
-                fix = needs_fixing(outputBuffer);
-            } else throw mc2_exception("Compressed texture larger than decompressed is invalid");
-
-            if (fix) {
-                std::cout << name << " - " << std::flush;
-                bool modified = fix_dxt(outputBuffer);
-                if (modified) {
-                    file.decompressLen = static_cast<uint32_t>(outputBuffer.size());
-                    compressBuffer.resize(outputBuffer.size() - 1);
-                    bool smaller = compress(outputBuffer, compressBuffer);
-                    if (!smaller) std::swap(outputBuffer, compressBuffer);
-                    file.compressLen = static_cast<uint32_t>(compressBuffer.size());
-                    std::cout << "Patched" << std::endl;
-                } else {
-                    std::cout << "Good" << std::endl;
+
+    stream_writer writer(out);
+    process_archive(writer, header, files, names, [&in](entry_job &job) {
+        job.data.resize(job.file.compressLen);
+        helper_read_at(in, job.file.dataOffset, job.data);
+        job.payload = job.data;
+    }, nullptr);
+
+    in.exceptions(in_exc), out.exceptions(out_exc);
+}
+
+namespace {
+    // With Async_IO, has the kernel start reading the payloads of the next
+    // entries in the background while the current ones are worked on, so
+    // that the mapping finds them in the page cache
+    class payload_read_ahead {
+    public:
+        static constexpr std::size_t Entries = 32;
+
+        payload_read_ahead(const dat_map &in, span<const file_info> files) : in(in), files(files) {
+            if (!Async_IO || !io_ring::available()) return;
+            try {
+                ring.reset(new io_ring(Entries));
+            } catch (std::ios_base::failure &) { }
+        }
+
+        // Entry k is about to be loaded
+        void advance(std::size_t k) {
+            if (!ring) return;
+            io_ring::completion done;
+            while (ring->reap(done)) --outstanding; // only advice, so failures don't matter
+            for (; next < files.size() && next < k + Entries && outstanding < ring->entries(); ++next, ++outstanding) {
+#ifndef _WIN32
+                ring->will_need(in.descriptor(), files[next].dataOffset, files[next].compressLen, next);
+#endif
+            }
+            ring->submit();
+        }
+
+    private:
+        const dat_map &in;
+        span<const file_info> files;
+        std::unique_ptr<io_ring> ring;
+        std::size_t next = 0;
+        unsigned outstanding = 0;
+    };
+}
+
+void process_textures(const dat_map &in, dat_writer &out, dat_manifest *manifest) {
+    const dat_header header = in.header();
+    helper_is_base64(header);
+
+    span<const file_info> table = in.files();
+    std::vector<file_info> files(table.begin(), table.end());
+
+    payload_read_ahead ahead(in, table);
+    std::size_t loaded = 0;
+    process_archive(out, header, files, in.names(), [&in, &ahead, &loaded](entry_job &job) {
+        ahead.advance(loaded++);
+        job.payload = in.payload(job.file);
+    }, manifest);
+}
+
+namespace {
+    // Reads the payloads in the given order on its own thread, staying at
+    // most limit bytes ahead of the consumer. Entries that share their data
+    // are read once and copied.
+    class payload_prefetch {
+    public:
+        payload_prefetch(forward_reader &in, const std::vector<file_info> &files, const std::vector<std::uint32_t> &order,
+                         std::size_t limit) : in(in), files(files), order(order), limit(limit) {
+            reader = std::thread(&payload_prefetch::run, this);
+        }
+        ~payload_prefetch() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            changed.notify_all();
+            reader.join();
+        }
+
+        // Swaps the next payload into buffer, keeping buffer's old storage for reuse
+        void next(std::vector<char> &buffer) {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [this]() { return !ready.empty() || error; });
+            if (ready.empty()) std::rethrow_exception(error);
+            buffered -= ready.front().size();
+            buffer.swap(ready.front());
+            spare.push_back(std::move(ready.front()));
+            ready.pop_front();
+            changed.notify_all();
+        }
+
+    private:
+        static bool same_data(const file_info &a, const file_info &b) {
+            return a.dataOffset == b.dataOffset && a.compressLen == b.compressLen;
+        }
+
+        void run() {
+            try {
+                for (std::size_t k = 0; k < order.size();) {
+                    const file_info &file = files[order[k]];
+                    std::size_t shared = 1;
+                    while (k + shared < order.size() && same_data(files[order[k + shared]], file)) ++shared;
+
+                    std::vector<char> data;
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+                        changed.wait(guard, [this]() { return stopping || buffered < limit; });
+                        if (stopping) return;
+                        if (!spare.empty()) data.swap(spare.back()), spare.pop_back();
+                    }
+                    in.skip_to(file.dataOffset);
+                    data.resize(file.compressLen);
+                    in.read(data.data(), data.size());
+
+                    std::lock_guard<std::mutex> guard(lock);
+                    for (std::size_t copy = 1; copy < shared; ++copy) ready.push_back(data), buffered += data.size();
+                    buffered += data.size();
+                    ready.push_back(std::move(data));
+                    changed.notify_all();
+                    k += shared;
                 }
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(lock);
+                error = std::current_exception();
+                changed.notify_all();
             }
         }
 
-        file.dataOffset = helper_write_pad(out, compressBuffer);
+        forward_reader &in;
+        const std::vector<file_info> &files;
+        const std::vector<std::uint32_t> &order;
+        const std::size_t limit;
+
+        std::mutex lock;
+        std::condition_variable changed;
+        std::deque<std::vector<char>> ready;
+        std::vector<std::vector<char>> spare;
+        std::size_t buffered = 0;
+        bool stopping = false;
+        std::exception_ptr error;
+        std::thread reader;
+    };
+}
+
+template<class T> static void helper_read_forward(forward_reader &in, std::uint64_t pos, std::vector<T> &v) {
+    in.skip_to(pos);
+    in.read(reinterpret_cast<char *>(v.data()), v.size() * sizeof(T));
+}
+
+void process_textures_sequential(forward_reader &in, dat_writer &out) {
+    dat_header header;
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    helper_is_base64(header);
+    if (static_cast<std::uint64_t>(header.numFiles) * sizeof(file_info) > header.metaLen)
+        throw mc2_exception("File Directory overlaps the name table, so the archive can't be read in one pass");
+
+    std::vector<file_info> files(header.numFiles);
+    helper_read_forward(in, 2048, files);
+    std::vector<std::uint8_t> names(header.nameLen);
+    helper_read_forward(in, 2048 + static_cast<std::uint64_t>(header.metaLen), names);
+
+    // Visit the entries as they lie in the file, whatever the directory order
+    std::vector<std::uint32_t> order(files.size());
+    for (std::uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&files](std::uint32_t a, std::uint32_t b) {
+        if (files[a].dataOffset != files[b].dataOffset) return files[a].dataOffset < files[b].dataOffset;
+        return files[a].compressLen < files[b].compressLen;
+    });
+
+    payload_prefetch prefetch(in, files, order, 64 << 20);
+    process_archive(out, header, files, names, [&prefetch](entry_job &job) {
+        prefetch.next(job.data);
+        job.payload = job.data;
+    }, nullptr, &order);
+}
+
+/*
+ * Undo journal for in-place patching:
+ * journal_header, then any number of journal_record, each
+ * followed by the original bytes it covers. Records are
+ * appended and flushed before their range is overwritten,
+ * so a truncated last record was never applied.
+ */
+struct journal_header { std::uint32_t magic, version; std::uint64_t fileSize; };
+struct journal_record { std::uint64_t offset, length; };
+
+constexpr std::uint32_t MAGIC_JOURNAL = 0x4A32434D; // "MC2J"
+
+static void helper_journal(file_writer &journal, std::uint64_t offset, span<const char> original) {
+    journal_record record = { offset, original.size() };
+    journal.write({ reinterpret_cast<const char *>(&record), sizeof(record) });
+    journal.write(original);
+    journal.sync();
+}
+
+void process_textures_in_place(const std::string &dat_name, const std::string &journal_name, dat_manifest *manifest) {
+    if (std::ifstream(journal_name)) throw mc2_exception("Undo journal already exists. Undo or remove it first.");
+
+    dat_map in(dat_name);
+    const dat_header header = in.header();
+    helper_is_base64(header);
+
+    span<const file_info> table = in.files();
+    std::vector<file_info> files(table.begin(), table.end());
+
+    // Each entry may grow up to the start of the next entry's data
+    const std::uint64_t fileEnd = (in.size() + 2047) & ~static_cast<std::uint64_t>(2047);
+    std::vector<std::uint32_t> offsets;
+    offsets.reserve(files.size());
+    for (const file_info &file : files) offsets.push_back(file.dataOffset);
+    std::sort(offsets.begin(), offsets.end());
+
+    file_writer journal(journal_name);
+    journal_header jheader = { MAGIC_JOURNAL, 1, in.size() };
+    journal.write({ reinterpret_cast<const char *>(&jheader), sizeof(jheader) });
+    helper_journal(journal, 2048, in.bytes().subspan(2048, files.size() * sizeof(file_info)));
+
+    file_writer out(dat_name, &in, false);
+    out.seek(fileEnd);
+    bool appended = false;
+    std::uint64_t size = in.size(); // grows if the last entry does, in its padding
+    process_entries(header, files, in.names(), [&in](entry_job &job) {
+        job.payload = in.payload(job.file);
+    }, [&](entry_job &job) {
+        if (!job.patched) return;
+        const std::uint32_t offset = job.file.dataOffset;
+        auto range = std::equal_range(offsets.begin(), offsets.end(), offset);
+        const std::uint64_t slotEnd = range.second == offsets.end() ? fileEnd : *range.second;
+        // Entries sharing data can't be changed for only one of them
+        if (range.second - range.first == 1 && job.payload.size() <= slotEnd - offset) {
+            // The last slot runs to the padded end, past the mapping; undo
+            // truncates whatever was written beyond the old end of file
+            const std::size_t kept = static_cast<std::size_t>(std::min<std::uint64_t>(job.payload.size(), in.size() - offset));
+            helper_journal(journal, offset, in.bytes().subspan(offset, kept));
+            const std::uint64_t end = out.tell();
+            out.seek(offset);
+            out.write(job.payload);
+            size = std::max<std::uint64_t>(size, out.tell());
+            out.seek(end);
+            stat_add(&dat_stats::bytesWritten, job.payload.size());
+        } else {
+            job.file.dataOffset = helper_write_pad(out, job.payload);
+            appended = true;
+        }
+    }, manifest);
+
+    if (appended) {
+        // pad end of file
+        const std::uint64_t end = (out.tell() + 2047) & ~static_cast<std::uint64_t>(2047);
+        stat_add(&dat_stats::paddingBytes, end - out.tell());
+        out.seek(end - 1);
+        out.write({ "", 1 });
+        size = out.tell();
+    }
+    out.sync();
+    if (manifest != nullptr) manifest->describe(size, files);
+
+    // rewrite only the changed directory records
+    std::uint32_t changed = 0;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (std::memcmp(&files[i], &table[i], sizeof(file_info)) == 0) continue;
+        helper_write_at(out, 2048 + i * sizeof(file_info), files[i]);
+        ++changed;
+    }
+    out.sync();
+    if (!Quiet_Output) std::cout << "Updated " << changed << " File Directory entries" << std::endl;
+}
+
+void undo_in_place(const std::string &dat_name, const std::string &journal_name) {
+    std::ifstream journal(journal_name, std::ios_base::in | std::ios_base::binary);
+    if (!journal) throw std::ios_base::failure("Unable to open undo journal");
+
+    journal_header jheader;
+    if (!journal.read(reinterpret_cast<char *>(&jheader), sizeof(jheader)) ||
+        jheader.magic != MAGIC_JOURNAL || jheader.version != 1)
+        throw mc2_exception("Not an undo journal");
+
+    file_writer out(dat_name, nullptr, false);
+    std::vector<char> original;
+    journal_record record;
+    while (journal.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+        if (record.offset + record.length > jheader.fileSize) throw mc2_exception("Corrupt undo journal");
+        original.resize(record.length);
+        if (!journal.read(original.data(), original.size())) break; // never applied
+        out.seek(record.offset);
+        out.write(original);
     }
-    
-    // pad end of file
-    out.seekp((((std::streamoff) out.tellp() + 2047) & ~((std::streamoff) 2047)) - 1, std::ios_base::beg);
-    out.put('\0');
-    
-    // write file directory
-    std::cout << "Writing new File Directory" << std::endl;
-    helper_write_at(out, 2048, files);
+    out.resize(jheader.fileSize);
+    out.sync();
+    journal.close();
+    std::remove(journal_name.c_str());
+}
 
-    in.exceptions(in_exc), out.exceptions(out_exc);
+std::vector<std::string> read_names(const dat_header &header, span<const file_info> files, span<const std::uint8_t> names) {
+    const name_table table(header, files, names);
+    std::vector<std::string> result;
+    result.reserve(table.size());
+    for (std::size_t i = 0; i < table.size(); ++i) result.emplace_back(table[i].begin(), table[i].end());
+    return result;
+}
+
+std::vector<std::string> read_names(const dat_map &in) {
+    return read_names(in.header(), in.files(), in.names());
 }
@@ -1,6 +1,67 @@
 #pragma once
 
+#include <cstddef>
 #include <iostream>
+#include <string>
+#include <vector>
+
+#include "dat_format.hpp"
+#include "span.hpp"
+
+class dat_manifest;
+class dat_map;
+class dat_writer;
+class forward_reader;
+class name_filter;
+class thread_pool;
 
 extern int Zlib_Compression_Level;
+extern int Worker_Threads; // 0 uses every hardware thread
+// --optimize: tries several deflate settings per patched texture and keeps
+// the smallest, plus an exhaustive pass of up to this many ms if > 0
+extern bool Optimize_Compression;
+extern unsigned Exhaustive_Budget;
+// Textures over 4 windows are inflated, fixed and deflated this many bytes
+// at a time rather than whole; 0 keeps every texture in memory
+extern std::size_t Texture_Window;
+// --splice: patched textures keep their original deflate blocks up to the
+// first changed byte and only the rest is deflated again
+extern bool Splice_Deflate;
+// --dedup: entries whose payloads are identical are processed once and
+// written once, the others pointing at the first copy's data
+extern bool Dedup_Entries;
+// --solver-stats: what the DXT5 fix did per texture and per archive, in
+// builds with the solver counters (see solver_counters.hpp)
+extern bool Solver_Stats;
+// --verify: patched textures are decoded before and after the fix, and how
+// far they moved reported per texture and per archive (see dxt_verify.hpp)
+extern bool Verify_Textures;
+extern bool Quiet_Output; // no per-entry lines or progress messages, only errors
+extern name_filter Name_Filter; // textures left out by --only / --exclude are passed through
+// Batch runs point this at one pool that the entries of every archive go
+// to; otherwise each archive gets a pool of its own
+extern thread_pool *Shared_Pool;
+// Likewise for the --optimize candidates, which entry jobs wait on
+extern thread_pool *Search_Pool;
+
+// Verdicts of the entries committed on the calling thread, while it points somewhere
+struct archive_tally {
+    std::size_t skipped = 0, good = 0, patched = 0, unchanged = 0; // unchanged: passed through by the manifest
+};
+extern thread_local archive_tally *Archive_Tally;
+
 void process_textures(std::istream &in, std::ostream &out);
+// With a manifest, textures it lists as already checked are passed through
+// untouched, and the manifest is updated to describe the new archive.
+void process_textures(const dat_map &in, dat_writer &out, dat_manifest *manifest = nullptr);
+
+// Reads the input front to back only, so it can be a pipe. Entries are
+// written in the order they were stored in, which needn't be directory order.
+void process_textures_sequential(forward_reader &in, dat_writer &out);
+
+// Patches the archive where it is, keeping an undo journal instead of a full backup
+void process_textures_in_place(const std::string &dat_name, const std::string &journal_name, dat_manifest *manifest = nullptr);
+void undo_in_place(const std::string &dat_name, const std::string &journal_name);
+
+std::vector<std::string> read_names(const dat_header &header, span<const file_info> files, span<const std::uint8_t> names);
+std::vector<std::string> read_names(const dat_map &in);
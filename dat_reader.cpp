@@ -0,0 +1,80 @@
+#include "dat_reader.hpp"
+
+#include <ios>
+
+#include "dat_map.hpp"
+#include "mc2_exception.hpp"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+std::uint64_t map_reader::size() {
+    return map.size();
+}
+
+span<const char> map_reader::read(std::uint64_t offset, std::size_t length, std::vector<char> &buffer) {
+    (void) buffer;
+    if (offset > map.size() || length > map.size() - offset) throw std::ios_base::failure("Read past the end of the archive");
+    return map.bytes().subspan(static_cast<std::size_t>(offset), length);
+}
+
+std::uint64_t stream_reader::size() {
+    in.seekg(0, std::ios_base::end);
+    const std::streamoff end = in.tellg();
+    if (!in || end < 0) throw std::ios_base::failure("Unable to find the size of the archive");
+    return static_cast<std::uint64_t>(end);
+}
+
+span<const char> stream_reader::read(std::uint64_t offset, std::size_t length, std::vector<char> &buffer) {
+    buffer.resize(length);
+    in.seekg(static_cast<std::streamoff>(offset));
+    in.read(buffer.data(), static_cast<std::streamsize>(length));
+    if (!in) {
+        in.clear();
+        throw std::ios_base::failure("Read past the end of the archive");
+    }
+    return buffer;
+}
+
+forward_reader::forward_reader(const std::string &path) : owned(path != "-") {
+    if (owned) file = std::fopen(path.c_str(), "rb");
+    else {
+        file = stdin;
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    }
+    if (file == nullptr) throw std::ios_base::failure("Unable to open archive");
+    // Large reads, as the input may well be a pipe or a network share
+    if (owned) buffer.resize(1 << 20);
+    std::setvbuf(file, owned ? buffer.data() : nullptr, _IOFBF, 1 << 20);
+
+#if !defined(_WIN32) && defined(POSIX_FADV_SEQUENTIAL)
+    struct stat st;
+    if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode))
+        posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+forward_reader::~forward_reader() {
+    if (owned) std::fclose(file);
+}
+
+void forward_reader::read(char *data, std::size_t length) {
+    if (std::fread(data, 1, length, file) != length) throw std::ios_base::failure("Unexpected end of archive");
+    pos += length;
+}
+
+void forward_reader::skip_to(std::uint64_t offset) {
+    if (offset < pos) throw mc2_exception("Entries overlap or lie before the name table, so the archive can't be read in one pass");
+    char discard[4096];
+    while (pos < offset) {
+        const std::size_t n = offset - pos < sizeof(discard) ? static_cast<std::size_t>(offset - pos) : sizeof(discard);
+        read(discard, n);
+    }
+}
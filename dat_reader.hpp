@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <cstdio>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "span.hpp"
+
+class dat_map;
+
+// Input side of dat_archive
+class dat_reader {
+public:
+    virtual ~dat_reader() = default;
+
+    virtual std::uint64_t size() = 0;
+
+    // length bytes at offset, either viewed in memory the reader already
+    // holds or read into buffer. Throws std::ios_base::failure past the end.
+    virtual span<const char> read(std::uint64_t offset, std::size_t length, std::vector<char> &buffer) = 0;
+};
+
+// Hands out views of a mapped archive without copying
+class map_reader : public dat_reader {
+public:
+    explicit map_reader(const dat_map &map) : map(map) { }
+
+    std::uint64_t size() override;
+    span<const char> read(std::uint64_t offset, std::size_t length, std::vector<char> &buffer) override;
+
+private:
+    const dat_map &map;
+};
+
+class stream_reader : public dat_reader {
+public:
+    explicit stream_reader(std::istream &in) : in(in) { }
+
+    std::uint64_t size() override;
+    span<const char> read(std::uint64_t offset, std::size_t length, std::vector<char> &buffer) override;
+
+private:
+    std::istream &in;
+};
+
+// Reads an archive strictly front to back, so that it can come from a pipe.
+// "-" is stdin. Regular files are read with sequential readahead.
+class forward_reader {
+public:
+    explicit forward_reader(const std::string &path);
+    ~forward_reader();
+
+    forward_reader(const forward_reader &) = delete;
+    forward_reader &operator=(const forward_reader &) = delete;
+
+    std::uint64_t tell() const { return pos; }
+    void read(char *data, std::size_t length);
+    // Discards the input up to offset, which can't be behind tell()
+    void skip_to(std::uint64_t offset);
+
+private:
+    std::FILE *file;
+    bool owned;
+    std::uint64_t pos = 0;
+    std::vector<char> buffer;
+};
@@ -0,0 +1,113 @@
+#include "dat_stats.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+dat_stats *Run_Stats = nullptr;
+
+static const char *const StageNames[StatStages] = { "read", "inflate", "fix", "deflate", "write" };
+
+static std::uint64_t helper_wall_nanos() {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+#ifdef _WIN32
+static std::uint64_t helper_filetime(const FILETIME &kernel, const FILETIME &user) {
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime, k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime, u.HighPart = user.dwHighDateTime;
+    return (k.QuadPart + u.QuadPart) * 100; // 100ns units
+}
+
+static std::uint64_t helper_thread_cpu_nanos() {
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return 0;
+    return helper_filetime(kernel, user);
+}
+
+static std::uint64_t helper_process_cpu_nanos() {
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0;
+    return helper_filetime(kernel, user);
+}
+#else
+static std::uint64_t helper_clock_nanos(clockid_t clock) {
+    timespec ts;
+    if (clock_gettime(clock, &ts) != 0) return 0;
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000u + static_cast<std::uint64_t>(ts.tv_nsec);
+}
+
+static std::uint64_t helper_thread_cpu_nanos() { return helper_clock_nanos(CLOCK_THREAD_CPUTIME_ID); }
+static std::uint64_t helper_process_cpu_nanos() { return helper_clock_nanos(CLOCK_PROCESS_CPUTIME_ID); }
+#endif
+
+void stage_timer::begin() {
+    running = true;
+    wall = helper_wall_nanos();
+    cpu = helper_thread_cpu_nanos();
+}
+
+void stage_timer::end() {
+    const std::size_t i = static_cast<std::size_t>(stage);
+    Run_Stats->cpuNanos[i].fetch_add(helper_thread_cpu_nanos() - cpu, std::memory_order_relaxed);
+    Run_Stats->wallNanos[i].fetch_add(helper_wall_nanos() - wall, std::memory_order_relaxed);
+}
+
+dat_stats::dat_stats() {
+    for (std::size_t i = 0; i < StatStages; ++i) wallNanos[i] = 0, cpuNanos[i] = 0;
+    bytesRead = 0, bytesInflated = 0, bytesDeflated = 0, bytesWritten = 0, paddingBytes = 0;
+    skipped = 0, good = 0, patched = 0, unchanged = 0;
+}
+
+void dat_stats::start() {
+    startWall = helper_wall_nanos();
+    startCpu = helper_process_cpu_nanos();
+}
+
+void dat_stats::finish() {
+    totalWall = helper_wall_nanos() - startWall;
+    totalCpu = helper_process_cpu_nanos() - startCpu;
+}
+
+void dat_stats::print(std::ostream &out, bool json) const {
+    const double wall = totalWall / 1e9, cpu = totalCpu / 1e9;
+    const double rate = wall > 0 ? bytesRead / 1e6 / wall : 0;
+    if (json) {
+        out << "{\n  \"wall_s\": " << wall << ", \"cpu_s\": " << cpu << ", \"read_mb_per_s\": " << rate << ",\n";
+        out << "  \"stages\": {";
+        for (std::size_t i = 0; i < StatStages; ++i) {
+            out << (i == 0 ? " " : ", ") << '"' << StageNames[i] << "\": { \"wall_s\": " << wallNanos[i] / 1e9
+                << ", \"cpu_s\": " << cpuNanos[i] / 1e9 << " }";
+        }
+        out << " },\n";
+        out << "  \"bytes\": { \"read\": " << bytesRead << ", \"inflated\": " << bytesInflated << ", \"deflated\": " << bytesDeflated
+            << ", \"written\": " << bytesWritten << ", \"padding\": " << paddingBytes << " },\n";
+        out << "  \"entries\": { \"skipped\": " << skipped << ", \"good\": " << good << ", \"patched\": " << patched
+            << ", \"unchanged\": " << unchanged << " }\n}" << std::endl;
+        return;
+    }
+
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    out << "Stage      wall s     cpu s  (summed over threads)" << '\n';
+    for (std::size_t i = 0; i < StatStages; ++i) {
+        out << std::left << std::setw(8) << StageNames[i] << std::right << std::setw(9) << wallNanos[i] / 1e9
+            << std::setw(10) << cpuNanos[i] / 1e9 << '\n';
+    }
+    out << "Read " << bytesRead << " bytes, inflated " << bytesInflated << ", deflated " << bytesDeflated
+        << ", wrote " << bytesWritten << " with " << paddingBytes << " bytes of padding" << '\n';
+    out << "Entries: " << skipped << " skipped, " << good << " good, " << patched << " patched, "
+        << unchanged << " unchanged since the last run" << '\n';
+    out << "Total: " << wall << " s wall, " << cpu << " s CPU, " << rate << " MB/s read" << std::endl;
+    out.flags(flags), out.precision(precision);
+}
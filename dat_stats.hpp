@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+
+enum class stat_stage { read, inflate, fix, deflate, write };
+constexpr std::size_t StatStages = 5;
+
+// Counters for one run, shared by all the workers. Stage times are summed
+// over threads, so with -jN they can add up to N times the wall clock.
+struct dat_stats {
+    std::atomic<std::uint64_t> wallNanos[StatStages], cpuNanos[StatStages];
+    std::atomic<std::uint64_t> bytesRead, bytesInflated, bytesDeflated, bytesWritten, paddingBytes;
+    std::atomic<std::uint64_t> skipped, good, patched, unchanged;
+
+    dat_stats();
+    void start();
+    void finish();
+    void print(std::ostream &out, bool json) const;
+
+private:
+    std::uint64_t startWall = 0, startCpu = 0, totalWall = 0, totalCpu = 0;
+};
+
+// Only collected while this points somewhere, so a plain run pays one
+// branch per stage
+extern dat_stats *Run_Stats;
+
+inline void stat_add(std::atomic<std::uint64_t> dat_stats::*counter, std::uint64_t n) {
+    if (Run_Stats != nullptr) (Run_Stats->*counter).fetch_add(n, std::memory_order_relaxed);
+}
+
+// Adds the wall and thread CPU time of its scope to a stage
+class stage_timer {
+public:
+    explicit stage_timer(stat_stage stage) : stage(stage) {
+        if (Run_Stats != nullptr) begin();
+    }
+    ~stage_timer() {
+        if (running) end();
+    }
+
+    stage_timer(const stage_timer &) = delete;
+    stage_timer &operator=(const stage_timer &) = delete;
+
+private:
+    void begin();
+    void end();
+
+    stat_stage stage;
+    bool running = false;
+    std::uint64_t wall = 0, cpu = 0;
+};
@@ -0,0 +1,266 @@
+#include "dat_writer.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <ios>
+
+#include "dat_map.hpp"
+#include "dat_stats.hpp"
+#include "io_ring.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+
+bool Async_IO = false;
+
+std::uint32_t seek_pad(dat_writer &out, std::size_t size) {
+    const std::size_t padding = (2048 - (out.tell() % 2048)) % 2048;
+    // Don't pad if data can fit in padding
+    if (size > padding) {
+        out.seek(out.tell() + padding);
+        stat_add(&dat_stats::paddingBytes, padding);
+    }
+    return static_cast<std::uint32_t>(out.tell());
+}
+
+#ifdef _WIN32
+
+file_writer::file_writer(const std::string &path, const dat_map *source, bool truncate) : source(source) {
+    file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                       truncate ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) throw std::ios_base::failure(truncate ? "Unable to create new archive" : "Unable to open archive for writing");
+}
+
+file_writer::~file_writer() {
+    CloseHandle(file);
+}
+
+void file_writer::write(span<const char> data) {
+    const char *p = data.data();
+    std::size_t left = data.size();
+    while (left > 0) {
+        OVERLAPPED at = {};
+        at.Offset = static_cast<DWORD>(pos), at.OffsetHigh = static_cast<DWORD>(pos >> 32);
+        DWORD chunk = left > 0x40000000 ? 0x40000000 : static_cast<DWORD>(left), written;
+        if (!WriteFile(file, p, chunk, &written, &at)) throw std::ios_base::failure("Unable to write archive");
+        p += written, left -= written, pos += written;
+    }
+}
+
+void file_writer::copy(span<const char> data, std::uint64_t /*src_offset*/) { write(data); }
+
+void file_writer::flush() { }
+
+void file_writer::resize(std::uint64_t size) {
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(size);
+    if (!SetFilePointerEx(file, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+        throw std::ios_base::failure("Unable to resize archive");
+}
+
+void file_writer::sync() {
+    if (!FlushFileBuffers(file)) throw std::ios_base::failure("Unable to flush archive to disk");
+}
+
+#else
+
+// Queued writes in flight at once, and the most each one takes
+constexpr unsigned Write_Slots = 16;
+constexpr std::size_t Write_Slot_Size = 256 << 10;
+
+static void helper_pwrite(int fd, const char *p, std::size_t left, std::uint64_t pos) {
+    while (left > 0) {
+        ssize_t ret = pwrite(fd, p, left, static_cast<off_t>(pos));
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            throw std::ios_base::failure("Unable to write archive");
+        }
+        p += ret, left -= static_cast<std::size_t>(ret), pos += static_cast<std::uint64_t>(ret);
+    }
+}
+
+file_writer::file_writer(const std::string &path, const dat_map *source, bool truncate) : source(source) {
+    fd = truncate ? open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666) : open(path.c_str(), O_WRONLY);
+    if (fd < 0) throw std::ios_base::failure(truncate ? "Unable to create new archive" : "Unable to open archive for writing");
+
+#ifdef __linux__
+    if (source != nullptr && source->descriptor() >= 0) {
+        method = COPY_RANGE;
+        struct stat in_st, out_st;
+        if (fstat(source->descriptor(), &in_st) == 0 && fstat(fd, &out_st) == 0) {
+            // Extents can only be shared within one filesystem, in whole blocks
+            if (in_st.st_dev == out_st.st_dev && in_st.st_blksize == out_st.st_blksize && in_st.st_blksize > 0)
+                block = static_cast<std::uint64_t>(in_st.st_blksize);
+        }
+    }
+#endif
+
+    if (Async_IO && io_ring::available()) {
+        try {
+            ring.reset(new io_ring(Write_Slots));
+        } catch (std::ios_base::failure &) {
+            return; // out of locked memory or the like; write synchronously
+        }
+        slab.resize(Write_Slots * Write_Slot_Size);
+        queued.assign(Write_Slots, { 0, 0 });
+        std::vector<span<char>> buffers;
+        for (unsigned slot = 0; slot < Write_Slots; ++slot) {
+            free_slots.push_back(Write_Slots - 1 - slot);
+            buffers.emplace_back(slab.data() + slot * Write_Slot_Size, Write_Slot_Size);
+        }
+        registered = ring->register_buffers(buffers);
+    }
+}
+
+file_writer::~file_writer() {
+    try {
+        flush();
+    } catch (std::ios_base::failure &) {
+        // Only reached when unwinding from another error
+    }
+    close(fd);
+}
+
+void file_writer::write(span<const char> data) {
+    if (ring) return queue_write(data);
+    helper_pwrite(fd, data.data(), data.size(), pos);
+    pos += data.size();
+}
+
+void file_writer::queue_write(span<const char> data) {
+    while (!data.empty()) {
+        const std::size_t n = std::min(data.size(), Write_Slot_Size);
+        // Writes in flight land in any order, so none may overlap another
+        if (in_flight(pos, n)) wait_writes(true);
+        while (free_slots.empty()) wait_writes(false);
+        const unsigned slot = free_slots.back();
+        free_slots.pop_back();
+
+        char *buffer = slab.data() + slot * Write_Slot_Size;
+        std::memcpy(buffer, data.data(), n);
+        queued[slot] = { pos, static_cast<std::uint32_t>(n) };
+        ring->write(fd, buffer, static_cast<std::uint32_t>(n), pos, slot, registered ? static_cast<int>(slot) : -1);
+        ring->submit();
+        pos += n;
+        data = data.subspan(n, data.size() - n);
+    }
+}
+
+// Reaps finished writes after waiting for one, or for all of them
+void file_writer::wait_writes(bool all) {
+    bool failed = false;
+    while (free_slots.size() < queued.size()) {
+        ring->submit(1);
+        io_ring::completion done;
+        while (ring->reap(done)) {
+            const unsigned slot = static_cast<unsigned>(done.tag);
+            queued_write &write = queued[slot];
+            if (done.result < 0) failed = true;
+            else if (static_cast<std::uint32_t>(done.result) < write.length) {
+                // Short writes are finished in place
+                const std::uint32_t at = static_cast<std::uint32_t>(done.result);
+                helper_pwrite(fd, slab.data() + slot * Write_Slot_Size + at, write.length - at, write.offset + at);
+            }
+            write.length = 0;
+            free_slots.push_back(slot);
+        }
+        if (!all) break;
+    }
+    if (failed) throw std::ios_base::failure("Unable to write archive");
+}
+
+bool file_writer::in_flight(std::uint64_t offset, std::uint64_t length) const {
+    for (const queued_write &write : queued)
+        if (write.length != 0 && offset < write.offset + write.length && write.offset < offset + length) return true;
+    return false;
+}
+
+void file_writer::flush() {
+    if (ring) wait_writes(true);
+}
+
+bool file_writer::copy_clone(std::uint64_t src_offset, std::uint64_t length) {
+#ifdef FICLONERANGE
+    file_clone_range range;
+    range.src_fd = source->descriptor();
+    range.src_offset = src_offset;
+    range.src_length = length;
+    range.dest_offset = pos;
+    if (ioctl(fd, FICLONERANGE, &range) == 0) {
+        pos += length;
+        return true;
+    }
+#else
+    (void) src_offset, (void) length;
+#endif
+    // Any failure means this filesystem can't reflink, so stop trying
+    block = 0;
+    return false;
+}
+
+// Returns the number of bytes at the end that the kernel did not copy
+std::uint64_t file_writer::copy_kernel(std::uint64_t src_offset, std::uint64_t length) {
+#ifdef __linux__
+    while (length > 0 && method == COPY_RANGE) {
+        loff_t in_off = static_cast<loff_t>(src_offset), out_off = static_cast<loff_t>(pos);
+        ssize_t ret = copy_file_range(source->descriptor(), &in_off, fd, &out_off, length, 0);
+        if (ret > 0) {
+            src_offset += static_cast<std::uint64_t>(ret), pos += static_cast<std::uint64_t>(ret);
+            length -= static_cast<std::uint64_t>(ret);
+        } else if (ret < 0 && errno == EINTR) continue;
+        else method = SENDFILE; // ENOSYS, EXDEV, EINVAL, ... or no progress
+    }
+    while (length > 0 && method == SENDFILE) {
+        off_t in_off = static_cast<off_t>(src_offset);
+        if (lseek(fd, static_cast<off_t>(pos), SEEK_SET) < 0) throw std::ios_base::failure("Unable to seek archive");
+        ssize_t ret = sendfile(fd, source->descriptor(), &in_off, length);
+        if (ret > 0) {
+            src_offset += static_cast<std::uint64_t>(ret), pos += static_cast<std::uint64_t>(ret);
+            length -= static_cast<std::uint64_t>(ret);
+        } else if (ret < 0 && errno == EINTR) continue;
+        else method = WRITE;
+    }
+#else
+    (void) src_offset;
+#endif
+    return length;
+}
+
+void file_writer::copy(span<const char> data, std::uint64_t src_offset) {
+    if (method == WRITE) return write(data);
+    if (ring && in_flight(pos, data.size())) wait_writes(true);
+
+    std::uint64_t length = data.size();
+    if (block != 0 && length >= block && src_offset % block == 0 && pos % block == 0) {
+        // Clone the whole blocks, and copy the partial block at the end
+        const std::uint64_t whole = length - length % block;
+        if (copy_clone(src_offset, whole)) src_offset += whole, length -= whole;
+    }
+    if (length > 0) length = copy_kernel(src_offset, length);
+    if (length > 0) write(data.subspan(data.size() - length, length));
+}
+
+void file_writer::resize(std::uint64_t size) {
+    flush();
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) throw std::ios_base::failure("Unable to resize archive");
+}
+
+void file_writer::sync() {
+    flush();
+    if (fsync(fd) != 0) throw std::ios_base::failure("Unable to flush archive to disk");
+}
+
+#endif
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "span.hpp"
+
+class dat_map;
+class io_ring;
+
+// --io=uring: file_writers queue their writes on an io_uring, where the
+// running kernel has one, and the mapped input is read ahead through it
+extern bool Async_IO;
+
+// Output side of process_textures
+class dat_writer {
+public:
+    virtual ~dat_writer() = default;
+
+    virtual std::uint64_t tell() = 0;
+    virtual void seek(std::uint64_t pos) = 0;
+    virtual void write(span<const char> data) = 0;
+
+    // Writes an entry that is unchanged from the input archive,
+    // where the same bytes start at src_offset
+    virtual void copy(span<const char> data, std::uint64_t /*src_offset*/) { write(data); }
+
+    // Waits for writes still in flight; their errors are thrown here
+    virtual void flush() { }
+};
+
+// Moves out to the next 2048-byte boundary, as the game lays out entries,
+// unless size bytes still fit before it. Returns where to write them.
+std::uint32_t seek_pad(dat_writer &out, std::size_t size);
+
+class stream_writer : public dat_writer {
+public:
+    explicit stream_writer(std::ostream &out) : out(out) { }
+
+    std::uint64_t tell() override { return static_cast<std::uint64_t>(out.tellp()); }
+    void seek(std::uint64_t pos) override { out.seekp(static_cast<std::streamoff>(pos)); }
+    void write(span<const char> data) override {
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+private:
+    std::ostream &out;
+};
+
+// Writes a new archive file. When given the mapped input archive, unchanged
+// entries are moved by the kernel (reflink, copy_file_range or sendfile)
+// instead of passing through userspace.
+// With truncate == false an existing file is opened for update instead.
+// With Async_IO, writes are copied into registered buffers and queued,
+// overlapping the caller's work; resize, sync and flush wait for them.
+class file_writer : public dat_writer {
+public:
+    explicit file_writer(const std::string &path, const dat_map *source = nullptr, bool truncate = true);
+    ~file_writer();
+
+    file_writer(const file_writer &) = delete;
+    file_writer &operator=(const file_writer &) = delete;
+
+    std::uint64_t tell() override { return pos; }
+    void seek(std::uint64_t p) override { pos = p; }
+    void write(span<const char> data) override;
+    void copy(span<const char> data, std::uint64_t src_offset) override;
+    void flush() override;
+
+    void resize(std::uint64_t size);
+    void sync(); // flush written data to the device
+
+private:
+    std::uint64_t pos = 0;
+    const dat_map *source;
+#ifdef _WIN32
+    void *file;
+#else
+    enum copy_method { COPY_RANGE, SENDFILE, WRITE };
+
+    bool copy_clone(std::uint64_t src_offset, std::uint64_t length);
+    std::uint64_t copy_kernel(std::uint64_t src_offset, std::uint64_t length);
+
+    int fd;
+    std::uint64_t block = 0; // reflink granularity, 0 when cloning is unavailable
+    copy_method method = WRITE;
+
+    struct queued_write {
+        std::uint64_t offset;
+        std::uint32_t length; // 0 while the slot is free
+    };
+
+    void queue_write(span<const char> data);
+    void wait_writes(bool all);
+    bool in_flight(std::uint64_t offset, std::uint64_t length) const;
+
+    std::unique_ptr<io_ring> ring;
+    std::vector<char> slab;             // one slot per queued write
+    std::vector<queued_write> queued;   // by slot
+    std::vector<unsigned> free_slots;
+    bool registered = false;
+#endif
+};
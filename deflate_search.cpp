@@ -0,0 +1,139 @@
+#include "deflate_search.hpp"
+
+#include <cstdlib>
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <memory>
+
+#include <zlib.h>
+#ifdef MC2_HAVE_ZOPFLI
+#include <zopfli.h>
+#endif
+
+#include "thread_pool.hpp"
+
+// Tried on top of the plain settings. DXT blocks are mostly short, noisy
+// matches, where the filtered and RLE strategies or a smaller memLevel
+// (which also shortens the deflate blocks) sometimes win.
+static const deflate_params Candidates[] = {
+    { 9, Z_DEFAULT_STRATEGY, 9 }, { 9, Z_DEFAULT_STRATEGY, 8 },
+    { 9, Z_FILTERED, 9 },         { 9, Z_FILTERED, 8 },
+    { 6, Z_DEFAULT_STRATEGY, 9 }, { 6, Z_FILTERED, 9 },
+    { 9, Z_RLE, 9 },              { 9, Z_HUFFMAN_ONLY, 9 },
+};
+constexpr std::size_t CandidateCount = sizeof(Candidates) / sizeof(Candidates[0]);
+
+// One zlib codec per candidate and thread, so no stream is ever re-initialised
+static codec &candidate_codec(std::size_t i) {
+    thread_local std::unique_ptr<codec> codecs[CandidateCount];
+    if (!codecs[i]) codecs[i] = make_codec(codec_backend::zlib);
+    return *codecs[i];
+}
+
+#ifdef MC2_HAVE_ZOPFLI
+// Nanoseconds per input byte and iteration of the last zopfli run
+static std::atomic<double> ZopfliCost(0);
+// Until a run has timed zopfli, it is timed on this much of the input first
+constexpr std::size_t ZopfliSample = 16 << 10;
+
+// One zopfli run, whose cost per byte and iteration goes into ZopfliCost
+static void helper_zopfli(span<const char> in, int iterations, unsigned char *&data, std::size_t &size) {
+    ZopfliOptions options;
+    ZopfliInitOptions(&options);
+    options.numiterations = iterations;
+    const auto start = std::chrono::steady_clock::now();
+    ZopfliCompress(&options, ZOPFLI_FORMAT_DEFLATE, reinterpret_cast<const unsigned char *>(in.data()), in.size(), &data, &size);
+    const std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+    ZopfliCost.store(took.count() / (static_cast<double>(in.size()) * iterations));
+}
+
+static bool exhaustive_deflate(span<const char> in, std::vector<char> &out, std::size_t limit,
+                               std::chrono::steady_clock::time_point deadline) {
+    unsigned char *data = nullptr;
+    std::size_t size = 0;
+    if (ZopfliCost.load() <= 0 && in.size() > ZopfliSample) {
+        if (std::chrono::steady_clock::now() >= deadline) return false;
+        helper_zopfli(in.subspan(0, ZopfliSample), 1, data, size);
+        std::free(data);
+        data = nullptr;
+    }
+
+    // Whatever the queue and the sample took comes out of the budget
+    const std::chrono::duration<double, std::nano> left = deadline - std::chrono::steady_clock::now();
+    if (left.count() <= 0) return false;
+    const double cost = ZopfliCost.load();
+    int iterations = 1;
+    if (cost > 0) {
+        const double fit = left.count() / (cost * static_cast<double>(in.size()));
+        if (fit < 1) return false; // even one iteration would overrun
+        iterations = fit < 15 ? static_cast<int>(fit) : 15;
+    }
+
+    helper_zopfli(in, iterations, data, size);
+    const bool fits = data != nullptr && size <= limit;
+    if (fits) out.assign(data, data + size);
+    std::free(data);
+    return fits;
+}
+#endif
+
+bool exhaustive_available() {
+#ifdef MC2_HAVE_ZOPFLI
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool deflate_smallest(thread_pool &pool, span<const char> in, std::vector<char> &out, std::size_t limit,
+                      const deflate_params &plain, unsigned budget, std::size_t &baseline) {
+    const bool plainIsZlib = Codec_Backend == codec_backend::zlib;
+    std::vector<std::future<std::vector<char>>> results;
+    for (std::size_t i = 0; i < CandidateCount; ++i) {
+        if (plainIsZlib && Candidates[i] == plain) continue;
+        results.push_back(pool.submit([in, limit, i]() {
+            std::vector<char> stream;
+            if (!candidate_codec(i).deflate(in, stream, limit, Candidates[i])) stream.clear();
+            return stream;
+        }));
+    }
+#ifdef MC2_HAVE_ZOPFLI
+    if (budget > 0) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(budget);
+        results.push_back(pool.submit([in, limit, deadline]() {
+            std::vector<char> stream;
+            if (!exhaustive_deflate(in, stream, limit, deadline)) stream.clear();
+            return stream;
+        }));
+    }
+#else
+    (void) budget;
+#endif
+
+    // The candidates read in, so every one of them is waited for before returning
+    std::exception_ptr error;
+    bool found = false;
+    try {
+        found = thread_codec().deflate(in, out, limit, plain);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    baseline = found ? out.size() : 0;
+
+    // Ties keep the earlier stream, so the choice among the zlib candidates
+    // doesn't depend on timing. The zopfli pass does: its iterations come
+    // from how fast earlier runs went and how much of the budget is left.
+    for (std::future<std::vector<char>> &result : results) {
+        try {
+            std::vector<char> stream = result.get();
+            if (!stream.empty() && (!found || stream.size() < out.size())) out.swap(stream), found = true;
+        } catch (...) {
+            if (!error) error = std::current_exception();
+        }
+    }
+    if (error) std::rethrow_exception(error);
+    return found;
+}
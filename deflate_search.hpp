@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+#include <vector>
+
+#include "codec.hpp"
+#include "span.hpp"
+
+class thread_pool;
+
+// Compresses in with every candidate setting, the plain one on this thread
+// and the rest on pool, and keeps the smallest stream in out. With a budget
+// (milliseconds per call) and zopfli in the build, an exhaustive pass is
+// added, sized by how fast the earlier passes ran to what is left of the
+// budget when it starts; a first pass is timed on a sample beforehand.
+// With it the output depends on timing, and can differ from run to run.
+// Returns false if nothing fit in limit bytes. baseline is set to the size
+// the plain settings alone gave, or 0 if that didn't fit.
+bool deflate_smallest(thread_pool &pool, span<const char> in, std::vector<char> &out, std::size_t limit,
+                      const deflate_params &plain, unsigned budget, std::size_t &baseline);
+
+bool exhaustive_available();
@@ -0,0 +1,69 @@
+#include "deflate_splice.hpp"
+
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "dat_stats.hpp"
+#include "mc2_exception.hpp"
+#include "zlib_streams.hpp"
+
+void inflate_blocks(span<const char> in, span<char> out, std::vector<deflate_block> &blocks) {
+    z_stream &strm = thread_zlib_streams().inflater();
+    strm.avail_in = static_cast<uInt>(in.size());
+    strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    strm.avail_out = static_cast<uInt>(out.size());
+    strm.next_out = reinterpret_cast<Bytef *>(out.data());
+
+    blocks.clear();
+    blocks.push_back({ 0, 0 });
+    for (;;) {
+        // Z_BLOCK returns at every block boundary, with the unused bits of
+        // the last byte read in data_type (zlib.h, as zran.c uses it)
+        int ret = ::inflate(&strm, Z_BLOCK);
+        if (ret == Z_STREAM_END) break;
+        if (ret == Z_BUF_ERROR && strm.avail_out == 0) throw mc2_exception("Decompressed size incorrect");
+        if (ret != Z_OK) throw zlib_exception(ret, strm.msg);
+        if ((strm.data_type & 128) == 0 || (strm.data_type & 64) != 0) continue;
+
+        const deflate_block block = { 8 * static_cast<std::uint64_t>(strm.total_in) - (strm.data_type & 7), strm.total_out };
+        if (block.bit != blocks.back().bit) blocks.push_back(block);
+    }
+    if (strm.avail_out != 0) throw mc2_exception("Decompressed size incorrect");
+    if (strm.avail_in != 0) throw mc2_exception("Compressed size incorrect");
+}
+
+bool deflate_splice(span<const char> original, const std::vector<deflate_block> &blocks, span<const char> data,
+                    std::size_t changed, std::vector<char> &out, std::size_t limit, int level) {
+    const deflate_block &start = *(std::upper_bound(blocks.begin(), blocks.end(), changed,
+        [](std::size_t at, const deflate_block &block) { return at < block.out; }) - 1);
+    const std::size_t kept = static_cast<std::size_t>(start.bit / 8);
+    const int bits = static_cast<int>(start.bit % 8);
+    if (kept >= limit) return false;
+
+    z_stream &strm = thread_zlib_streams().deflater(level);
+    const std::size_t window = std::min<std::size_t>(start.out, 32768);
+    int ret;
+    if (window != 0) {
+        ret = deflateSetDictionary(&strm, reinterpret_cast<const Bytef *>(data.data() + start.out - window), static_cast<uInt>(window));
+        if (ret != Z_OK) throw zlib_exception(ret, strm.msg);
+    }
+    // The new blocks go on right after the kept ones, in the middle of a byte
+    if (bits != 0 && (ret = deflatePrime(&strm, bits, static_cast<unsigned char>(original[kept]) & ((1 << bits) - 1))) != Z_OK)
+        throw zlib_exception(ret, strm.msg);
+
+    out.resize(limit);
+    std::copy(original.begin(), original.begin() + kept, out.begin());
+    const span<const char> tail = data.subspan(start.out, data.size() - start.out);
+    stat_add(&dat_stats::bytesDeflated, tail.size());
+    strm.avail_in = static_cast<uInt>(tail.size());
+    strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(tail.data()));
+    strm.avail_out = static_cast<uInt>(out.size() - kept);
+    strm.next_out = reinterpret_cast<Bytef *>(out.data() + kept);
+
+    ret = ::deflate(&strm, Z_FINISH);
+    if (ret == Z_OK) return false; // ran out of room, so compression doesn't pay
+    if (ret != Z_STREAM_END) throw zlib_exception(ret, strm.msg);
+    out.resize(out.size() - strm.avail_out);
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+#include "span.hpp"
+
+// Where a block of a raw deflate stream starts: bit offset into the
+// stream and byte offset into the inflated data
+struct deflate_block {
+    std::uint64_t bit;
+    std::size_t out;
+};
+
+// Inflates in into out, which it must fill exactly, like codec::inflate,
+// and records the start of every block. Always done with zlib.
+void inflate_blocks(span<const char> in, span<char> out, std::vector<deflate_block> &blocks);
+
+// Deflates data, which inflated from original as blocks describe up to
+// byte changed, by keeping the bits of original before the last block
+// starting at or before changed and deflating only the rest, primed with
+// the 32 KB before it as the dictionary. Returns false if the stream
+// would not fit in limit bytes, like codec::deflate.
+bool deflate_splice(span<const char> original, const std::vector<deflate_block> &blocks, span<const char> data,
+                    std::size_t changed, std::vector<char> &out, std::size_t limit, int level);
@@ -0,0 +1,278 @@
+#include "dxt_decode.hpp"
+
+#include <cstring>
+
+#include "simd.hpp"
+
+static inline std::uint32_t helper_load32(const char *p) {
+    std::uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline std::uint32_t helper_rgb(unsigned r, unsigned g, unsigned b) {
+    return r | (g << 8) | (b << 16);
+}
+
+// The four colors of a color block as RGBA8 with alpha 0: three colors
+// and black in the DXT1 sense if three
+static void helper_colors(std::uint16_t c0, std::uint16_t c1, bool three, std::uint32_t colors[4]) {
+    const unsigned r0 = (c0 >> 11) << 3 | (c0 >> 13), g0 = ((c0 >> 5) & 0x3F) << 2 | ((c0 >> 9) & 0x3), b0 = (c0 & 0x1F) << 3 | ((c0 >> 2) & 0x7);
+    const unsigned r1 = (c1 >> 11) << 3 | (c1 >> 13), g1 = ((c1 >> 5) & 0x3F) << 2 | ((c1 >> 9) & 0x3), b1 = (c1 & 0x1F) << 3 | ((c1 >> 2) & 0x7);
+    colors[0] = helper_rgb(r0, g0, b0);
+    colors[1] = helper_rgb(r1, g1, b1);
+    if (three) {
+        colors[2] = helper_rgb((r0 + r1 + 1) / 2, (g0 + g1 + 1) / 2, (b0 + b1 + 1) / 2);
+        colors[3] = 0;
+    } else {
+        colors[2] = helper_rgb((2 * r0 + r1 + 1) / 3, (2 * g0 + g1 + 1) / 3, (2 * b0 + b1 + 1) / 3);
+        colors[3] = helper_rgb((r0 + 2 * r1 + 1) / 3, (g0 + 2 * g1 + 1) / 3, (b0 + 2 * b1 + 1) / 3);
+    }
+}
+
+// The eight alphas of a DXT5 alpha block, in the top byte
+static void helper_alphas(unsigned a0, unsigned a1, std::uint32_t alphas[8]) {
+    alphas[0] = a0, alphas[1] = a1;
+    if (a0 > a1) {
+        for (unsigned k = 2; k < 8; ++k) alphas[k] = ((8 - k) * a0 + (k - 1) * a1 + 3) / 7;
+    } else {
+        for (unsigned k = 2; k < 6; ++k) alphas[k] = ((6 - k) * a0 + (k - 1) * a1 + 2) / 5;
+        alphas[6] = 0, alphas[7] = 255;
+    }
+    for (unsigned k = 0; k < 8; ++k) alphas[k] <<= 24;
+}
+
+void decode_dxt1_blocks_scalar(const char *data, std::size_t blocks, std::uint8_t *rgba) {
+    for (std::size_t i = 0; i < blocks; ++i, data += 8, rgba += 64) {
+        const std::uint16_t c0 = static_cast<std::uint16_t>(helper_load32(data)), c1 = static_cast<std::uint16_t>(helper_load32(data) >> 16);
+        std::uint32_t colors[4], texels[16];
+        helper_colors(c0, c1, c0 <= c1, colors);
+        for (unsigned k = 0; k < 3; ++k) colors[k] |= 0xFF000000u;
+        if (c0 > c1) colors[3] |= 0xFF000000u;
+        const std::uint32_t cv = helper_load32(data + 4);
+        for (unsigned t = 0; t < 16; ++t) texels[t] = colors[(cv >> (2 * t)) & 3];
+        std::memcpy(rgba, texels, sizeof(texels));
+    }
+}
+
+void decode_dxt5_blocks_scalar(const char *data, std::size_t blocks, std::uint8_t *rgba, bool intended) {
+    for (std::size_t i = 0; i < blocks; ++i, data += 16, rgba += 64) {
+        const std::uint16_t c0 = static_cast<std::uint16_t>(helper_load32(data + 8)), c1 = static_cast<std::uint16_t>(helper_load32(data + 8) >> 16);
+        std::uint32_t colors[4], alphas[8], texels[16];
+        helper_colors(c0, c1, intended && c0 <= c1, colors);
+        helper_alphas(static_cast<std::uint8_t>(data[0]), static_cast<std::uint8_t>(data[1]), alphas);
+        const std::uint32_t cv = helper_load32(data + 12);
+        std::uint64_t av = 0;
+        std::memcpy(&av, data + 2, 6);
+        for (unsigned t = 0; t < 16; ++t) texels[t] = colors[(cv >> (2 * t)) & 3] | alphas[(av >> (3 * t)) & 7];
+        std::memcpy(rgba, texels, sizeof(texels));
+    }
+}
+
+#ifdef MC2_SIMD_X86
+
+/*
+ * AVX2: the palettes of 8 blocks are worked out side by side, a block per
+ * 32-bit lane, then transposed so that each block's palette sits in a
+ * register its 2-bit (3-bit) indices pick from with one permute per 8
+ * texels. The arithmetic is the scalar one; division by 3, 5 and 7 is a
+ * multiply that is exact for every numerator here.
+ */
+namespace {
+    struct palettes {
+        // colors: blocks k and k + 4 in the halves of colors[k & 3]
+        __m256i colors[4];
+        // alphas: blocks k and k + 4 from the halves of low[k & 3] (alphas
+        // 0 to 3) and high[k & 3] (4 to 7)
+        __m256i low[4], high[4];
+    };
+}
+
+// 8-bit channels of 565 colors in the low 16 bits of each lane
+MC2_TARGET_AVX2 static inline void helper_widen(__m256i c, __m256i &r, __m256i &g, __m256i &b) {
+    const __m256i five = _mm256_set1_epi32(0x1F), six = _mm256_set1_epi32(0x3F);
+    r = _mm256_srli_epi32(c, 11);
+    g = _mm256_and_si256(_mm256_srli_epi32(c, 5), six);
+    b = _mm256_and_si256(c, five);
+    r = _mm256_or_si256(_mm256_slli_epi32(r, 3), _mm256_srli_epi32(r, 2));
+    g = _mm256_or_si256(_mm256_slli_epi32(g, 2), _mm256_srli_epi32(g, 4));
+    b = _mm256_or_si256(_mm256_slli_epi32(b, 3), _mm256_srli_epi32(b, 2));
+}
+
+// x / 3 for x < 2^16, as (x * 0xAAAB) >> 17
+MC2_TARGET_AVX2 static inline __m256i helper_div3(__m256i x) {
+    return _mm256_srli_epi32(_mm256_mulhi_epu16(x, _mm256_set1_epi32(0xAAAB)), 1);
+}
+
+// Third colors of a channel, the four color one where four, the three color one elsewhere
+MC2_TARGET_AVX2 static inline __m256i helper_third(__m256i x0, __m256i x1, __m256i four) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i by3 = helper_div3(_mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(x0, x0), x1), one));
+    const __m256i by2 = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(x0, x1), one), 1);
+    return _mm256_blendv_epi8(by2, by3, four);
+}
+
+MC2_TARGET_AVX2 static inline __m256i helper_fourth(__m256i x0, __m256i x1, __m256i four) {
+    const __m256i one = _mm256_set1_epi32(1);
+    return _mm256_and_si256(helper_div3(_mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(x1, x1), x0), one)), four);
+}
+
+MC2_TARGET_AVX2 static inline __m256i helper_pack(__m256i r, __m256i g, __m256i b) {
+    return _mm256_or_si256(r, _mm256_or_si256(_mm256_slli_epi32(g, 8), _mm256_slli_epi32(b, 16)));
+}
+
+// colors of the 8 blocks whose (cs0 | cs1 << 16) are in the lanes of c,
+// in block order; four masks the lanes decoded with four colors. With
+// opaque, the colors other than transparent black get alpha 255.
+MC2_TARGET_AVX2 static void helper_colors_avx2(__m256i c, __m256i four, bool opaque, palettes &out) {
+    __m256i r0, g0, b0, r1, g1, b1;
+    helper_widen(_mm256_and_si256(c, _mm256_set1_epi32(0xFFFF)), r0, g0, b0);
+    helper_widen(_mm256_srli_epi32(c, 16), r1, g1, b1);
+    __m256i p0 = helper_pack(r0, g0, b0), p1 = helper_pack(r1, g1, b1);
+    __m256i p2 = helper_pack(helper_third(r0, r1, four), helper_third(g0, g1, four), helper_third(b0, b1, four));
+    __m256i p3 = helper_pack(helper_fourth(r0, r1, four), helper_fourth(g0, g1, four), helper_fourth(b0, b1, four));
+    if (opaque) {
+        const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+        p0 = _mm256_or_si256(p0, alpha), p1 = _mm256_or_si256(p1, alpha), p2 = _mm256_or_si256(p2, alpha);
+        p3 = _mm256_or_si256(p3, _mm256_and_si256(alpha, four));
+    }
+    // 4x4 transposes within each half: block k's p0..p3 end up together
+    const __m256i t0 = _mm256_unpacklo_epi32(p0, p1), t1 = _mm256_unpacklo_epi32(p2, p3);
+    const __m256i t2 = _mm256_unpackhi_epi32(p0, p1), t3 = _mm256_unpackhi_epi32(p2, p3);
+    out.colors[0] = _mm256_unpacklo_epi64(t0, t1);
+    out.colors[1] = _mm256_unpackhi_epi64(t0, t1);
+    out.colors[2] = _mm256_unpacklo_epi64(t2, t3);
+    out.colors[3] = _mm256_unpackhi_epi64(t2, t3);
+}
+
+// alphas of the 8 blocks whose a0 and a1 are the low bytes of the lanes of a
+MC2_TARGET_AVX2 static void helper_alphas_avx2(__m256i a, palettes &out) {
+    const __m256i byte = _mm256_set1_epi32(0xFF);
+    const __m256i a0 = _mm256_and_si256(a, byte), a1 = _mm256_and_si256(_mm256_srli_epi32(a, 8), byte);
+    const __m256i eight = _mm256_cmpgt_epi32(a0, a1);
+    __m256i v[8];
+    v[0] = a0, v[1] = a1;
+    for (int k = 2; k < 8; ++k) {
+        // ((8 - k) a0 + (k - 1) a1 + 3) / 7, or ((6 - k) a0 + (k - 1) a1 + 2) / 5
+        const __m256i by7 = _mm256_mulhi_epu16(
+            _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi16(a0, _mm256_set1_epi32(8 - k)),
+                                              _mm256_mullo_epi16(a1, _mm256_set1_epi32(k - 1))), _mm256_set1_epi32(3)),
+            _mm256_set1_epi32(9363));
+        const __m256i by5 = k < 6 ? _mm256_mulhi_epu16(
+            _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi16(a0, _mm256_set1_epi32(6 - k)),
+                                              _mm256_mullo_epi16(a1, _mm256_set1_epi32(k - 1))), _mm256_set1_epi32(2)),
+            _mm256_set1_epi32(13108)) : k == 6 ? _mm256_setzero_si256() : byte;
+        v[k] = _mm256_blendv_epi8(by5, by7, eight);
+    }
+    for (int k = 0; k < 8; ++k) v[k] = _mm256_slli_epi32(v[k], 24);
+    for (int half = 0; half < 2; ++half) {
+        const __m256i *w = v + 4 * half;
+        const __m256i t0 = _mm256_unpacklo_epi32(w[0], w[1]), t1 = _mm256_unpacklo_epi32(w[2], w[3]);
+        const __m256i t2 = _mm256_unpackhi_epi32(w[0], w[1]), t3 = _mm256_unpackhi_epi32(w[2], w[3]);
+        __m256i *o = half == 0 ? out.low : out.high;
+        o[0] = _mm256_unpacklo_epi64(t0, t1);
+        o[1] = _mm256_unpackhi_epi64(t0, t1);
+        o[2] = _mm256_unpacklo_epi64(t2, t3);
+        o[3] = _mm256_unpackhi_epi64(t2, t3);
+    }
+}
+
+// The 16 color indices of cv, as two registers of 8, offset by 4 for the
+// blocks in the upper halves of the palettes
+MC2_TARGET_AVX2 static inline void helper_indices(std::uint32_t cv, bool upper, __m256i &lo, __m256i &hi) {
+    const __m256i shift_lo = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14), shift_hi = _mm256_setr_epi32(16, 18, 20, 22, 24, 26, 28, 30);
+    const __m256i mask = _mm256_set1_epi32(3), offset = _mm256_set1_epi32(upper ? 4 : 0);
+    const __m256i v = _mm256_set1_epi32(static_cast<int>(cv));
+    lo = _mm256_or_si256(_mm256_and_si256(_mm256_srlv_epi32(v, shift_lo), mask), offset);
+    hi = _mm256_or_si256(_mm256_and_si256(_mm256_srlv_epi32(v, shift_hi), mask), offset);
+}
+
+MC2_TARGET_AVX2 static void decode_dxt1_avx2(const char *data, std::size_t blocks, std::uint8_t *rgba) {
+    std::size_t i = 0;
+    for (; i + 8 <= blocks; i += 8) {
+        const char *p = data + i * 8;
+        const __m256 r0 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)));
+        const __m256 r1 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32)));
+        // Blocks 0 1 4 5 | 2 3 6 7, put back in order
+        const __m256i c = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(r0, r1, _MM_SHUFFLE(2, 0, 2, 0))),
+                                                   _MM_SHUFFLE(3, 1, 2, 0));
+        const __m256i four = _mm256_cmpgt_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0xFFFF)), _mm256_srli_epi32(c, 16));
+        palettes pal;
+        helper_colors_avx2(c, four, true, pal);
+        for (unsigned k = 0; k < 8; ++k) {
+            __m256i lo, hi;
+            helper_indices(helper_load32(p + k * 8 + 4), k >= 4, lo, hi);
+            __m256i *out = reinterpret_cast<__m256i *>(rgba + (i + k) * 64);
+            _mm256_storeu_si256(out, _mm256_permutevar8x32_epi32(pal.colors[k & 3], lo));
+            _mm256_storeu_si256(out + 1, _mm256_permutevar8x32_epi32(pal.colors[k & 3], hi));
+        }
+    }
+    decode_dxt1_blocks_scalar(data + i * 8, blocks - i, rgba + i * 64);
+}
+
+MC2_TARGET_AVX2 static void decode_dxt5_avx2(const char *data, std::size_t blocks, std::uint8_t *rgba, bool intended) {
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    const __m256i shift = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21), seven = _mm256_set1_epi32(7);
+    std::size_t i = 0;
+    for (; i + 8 <= blocks; i += 8) {
+        const char *p = data + i * 16;
+        const __m256i *q = reinterpret_cast<const __m256i *>(p);
+        // Dwords 0 (a0, a1, ...) and 2 (cs0, cs1) of each block, as in dxt_scan
+        const __m256i u0 = _mm256_unpacklo_epi32(_mm256_loadu_si256(q + 0), _mm256_loadu_si256(q + 1));
+        const __m256i u1 = _mm256_unpacklo_epi32(_mm256_loadu_si256(q + 2), _mm256_loadu_si256(q + 3));
+        const __m256i u2 = _mm256_unpackhi_epi32(_mm256_loadu_si256(q + 0), _mm256_loadu_si256(q + 1));
+        const __m256i u3 = _mm256_unpackhi_epi32(_mm256_loadu_si256(q + 2), _mm256_loadu_si256(q + 3));
+        const __m256i a = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(u0, u1), order);
+        const __m256i c = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(u2, u3), order);
+        const __m256i four = intended ? _mm256_cmpgt_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0xFFFF)), _mm256_srli_epi32(c, 16))
+                                      : _mm256_set1_epi32(-1);
+        palettes pal;
+        helper_colors_avx2(c, four, false, pal);
+        helper_alphas_avx2(a, pal);
+        for (unsigned k = 0; k < 8; ++k) {
+            const char *block = p + k * 16;
+            __m256i lo, hi;
+            helper_indices(helper_load32(block + 12), k >= 4, lo, hi);
+            const __m256i alphas = k < 4 ? _mm256_permute2x128_si256(pal.low[k & 3], pal.high[k & 3], 0x20)
+                                         : _mm256_permute2x128_si256(pal.low[k & 3], pal.high[k & 3], 0x31);
+            // 3-bit indices of texels 0 to 7 and 8 to 15, 24 bits each
+            const __m256i alo = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32(static_cast<int>(helper_load32(block + 2))), shift), seven);
+            const __m256i ahi = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32(static_cast<int>(helper_load32(block + 5))), shift), seven);
+            __m256i *out = reinterpret_cast<__m256i *>(rgba + (i + k) * 64);
+            _mm256_storeu_si256(out, _mm256_or_si256(_mm256_permutevar8x32_epi32(pal.colors[k & 3], lo),
+                                                     _mm256_permutevar8x32_epi32(alphas, alo)));
+            _mm256_storeu_si256(out + 1, _mm256_or_si256(_mm256_permutevar8x32_epi32(pal.colors[k & 3], hi),
+                                                         _mm256_permutevar8x32_epi32(alphas, ahi)));
+        }
+    }
+    decode_dxt5_blocks_scalar(data + i * 16, blocks - i, rgba + i * 64, intended);
+}
+
+#endif
+
+namespace {
+    typedef void (*dxt1_fn)(const char *, std::size_t, std::uint8_t *);
+    typedef void (*dxt5_fn)(const char *, std::size_t, std::uint8_t *, bool);
+    struct decode_impl { dxt1_fn dxt1; dxt5_fn dxt5; const char *name; };
+
+    const decode_impl &helper_select() {
+        static const decode_impl impl =
+#ifdef MC2_SIMD_X86
+            cpu_has_avx2() ? decode_impl{ decode_dxt1_avx2, decode_dxt5_avx2, "avx2" } :
+#endif
+            decode_impl{ decode_dxt1_blocks_scalar, decode_dxt5_blocks_scalar, "scalar" };
+        return impl;
+    }
+}
+
+void decode_dxt1_blocks(const char *data, std::size_t blocks, std::uint8_t *rgba) {
+    helper_select().dxt1(data, blocks, rgba);
+}
+
+void decode_dxt5_blocks(const char *data, std::size_t blocks, std::uint8_t *rgba, bool intended) {
+    helper_select().dxt5(data, blocks, rgba, intended);
+}
+
+const char *dxt_decode_isa() {
+    return helper_select().name;
+}
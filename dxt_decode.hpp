@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// DXT blocks decoded to RGBA8: 64 bytes per block, its 16 texels row by
+// row as r, g, b, a. 565 endpoints are widened by repeating their top
+// bits, and the colors between them rounded to nearest.
+
+// 8-byte DXT1 blocks (type 22): three colors and transparent black where
+// c0 <= c1
+void decode_dxt1_blocks(const char *data, std::size_t blocks, std::uint8_t *rgba);
+
+// 16-byte DXT5 blocks (type 26). The color half always has four colors,
+// as the game decodes it; intended reads c0 <= c1 as three colors and
+// black the way DXT1 does, which is what the textures were made for.
+void decode_dxt5_blocks(const char *data, std::size_t blocks, std::uint8_t *rgba, bool intended = false);
+
+// Portable versions, also used for the tail of the vector ones
+void decode_dxt1_blocks_scalar(const char *data, std::size_t blocks, std::uint8_t *rgba);
+void decode_dxt5_blocks_scalar(const char *data, std::size_t blocks, std::uint8_t *rgba, bool intended = false);
+
+// Name of the implementation the decoders picked for this CPU
+const char *dxt_decode_isa();
@@ -0,0 +1,108 @@
+#include "dxt_scan.hpp"
+
+#include <cstddef>
+#include <cstring>
+
+#include "fix_dxt.hpp"
+#include "simd.hpp"
+
+#if defined(MC2_SIMD_X86) && defined(_MSC_VER)
+#pragma intrinsic(_BitScanForward)
+#endif
+
+static_assert(sizeof(dxt5_chunk) == 16, "dxt5_chunk must match the on-disk block");
+static_assert(offsetof(dxt5_chunk, cs0) == 8 && offsetof(dxt5_chunk, cs1) == 10, "unexpected dxt5_chunk layout");
+
+static inline unsigned helper_lowest_bit(std::uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long bit;
+    _BitScanForward(&bit, mask);
+    return static_cast<unsigned>(bit);
+#elif defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#else
+    unsigned bit = 0;
+    while (!(mask & (1u << bit))) ++bit;
+    return bit;
+#endif
+}
+
+static void helper_emit(std::uint32_t mask, std::size_t base, std::vector<std::uint32_t> &out) {
+    while (mask != 0) {
+        out.push_back(static_cast<std::uint32_t>(base + helper_lowest_bit(mask)));
+        mask &= mask - 1;
+    }
+}
+
+void find_ambiguous_blocks_scalar(const char *data, std::size_t blocks, std::vector<std::uint32_t> &out) {
+    for (std::size_t i = 0; i < blocks; ++i) {
+        std::uint16_t cs[2];
+        std::memcpy(cs, data + i * sizeof(dxt5_chunk) + offsetof(dxt5_chunk, cs0), sizeof(cs));
+        if (cs[0] <= cs[1]) out.push_back(static_cast<std::uint32_t>(i));
+    }
+}
+
+#ifdef MC2_SIMD_X86
+
+// Gathers the (cs0 | cs1 << 16) dword of 4 blocks, and flags cs0 <= cs1
+static void find_sse2(const char *data, std::size_t blocks, std::vector<std::uint32_t> &out) {
+    const __m128i low = _mm_set1_epi32(0xFFFF);
+    std::size_t i = 0;
+    for (; i + 4 <= blocks; i += 4) {
+        const __m128i *p = reinterpret_cast<const __m128i *>(data + i * sizeof(dxt5_chunk));
+        __m128i t0 = _mm_unpackhi_epi32(_mm_loadu_si128(p + 0), _mm_loadu_si128(p + 1));
+        __m128i t1 = _mm_unpackhi_epi32(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3));
+        __m128i c = _mm_unpacklo_epi64(t0, t1);
+        __m128i good = _mm_cmpgt_epi32(_mm_and_si128(c, low), _mm_srli_epi32(c, 16));
+        std::uint32_t mask = ~_mm_movemask_ps(_mm_castsi128_ps(good)) & 0xF;
+        if (mask != 0) helper_emit(mask, i, out);
+    }
+    const std::size_t first = out.size();
+    find_ambiguous_blocks_scalar(data + i * sizeof(dxt5_chunk), blocks - i, out);
+    for (std::size_t k = first; k < out.size(); ++k) out[k] += static_cast<std::uint32_t>(i);
+}
+
+// Same gather over 8 blocks; unpack works per 128-bit lane, so it
+// yields blocks 0 2 4 6 | 1 3 5 7 and the permute restores the order
+MC2_TARGET_AVX2 static void find_avx2(const char *data, std::size_t blocks, std::vector<std::uint32_t> &out) {
+    const __m256i low = _mm256_set1_epi32(0xFFFF);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    std::size_t i = 0;
+    for (; i + 8 <= blocks; i += 8) {
+        const __m256i *p = reinterpret_cast<const __m256i *>(data + i * sizeof(dxt5_chunk));
+        __m256i t0 = _mm256_unpackhi_epi32(_mm256_loadu_si256(p + 0), _mm256_loadu_si256(p + 1));
+        __m256i t1 = _mm256_unpackhi_epi32(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3));
+        __m256i c = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(t0, t1), order);
+        __m256i good = _mm256_cmpgt_epi32(_mm256_and_si256(c, low), _mm256_srli_epi32(c, 16));
+        std::uint32_t mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(good)) & 0xFF;
+        if (mask != 0) helper_emit(mask, i, out);
+    }
+    const std::size_t first = out.size();
+    find_sse2(data + i * sizeof(dxt5_chunk), blocks - i, out);
+    for (std::size_t k = first; k < out.size(); ++k) out[k] += static_cast<std::uint32_t>(i);
+}
+
+#endif
+
+namespace {
+    typedef void (*scan_fn)(const char *, std::size_t, std::vector<std::uint32_t> &);
+    struct scan_impl { scan_fn fn; const char *name; };
+
+    const scan_impl &helper_select() {
+        static const scan_impl impl =
+#ifdef MC2_SIMD_X86
+            cpu_has_avx2() ? scan_impl{ find_avx2, "avx2" } : scan_impl{ find_sse2, "sse2" };
+#else
+            scan_impl{ find_ambiguous_blocks_scalar, "scalar" };
+#endif
+        return impl;
+    }
+}
+
+void find_ambiguous_blocks(const char *data, std::size_t blocks, std::vector<std::uint32_t> &out) {
+    helper_select().fn(data, blocks, out);
+}
+
+const char *dxt_scan_isa() {
+    return helper_select().name;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+// Finds the DXT5 blocks whose color endpoints have cs0 <= cs1, which are
+// the only ones fix_dxt has to touch. data points at `blocks` consecutive
+// 16-byte dxt5_chunk. Indices of the flagged blocks are appended to out.
+void find_ambiguous_blocks(const char *data, std::size_t blocks, std::vector<std::uint32_t> &out);
+
+// Portable version, also used for the tail of the vector versions
+void find_ambiguous_blocks_scalar(const char *data, std::size_t blocks, std::vector<std::uint32_t> &out);
+
+// Name of the implementation find_ambiguous_blocks picked for this CPU
+const char *dxt_scan_isa();
@@ -0,0 +1,118 @@
+#include "dxt_verify.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+
+#include "dxt_decode.hpp"
+#include "fix_dxt.hpp"
+
+constexpr std::size_t VerifyBatch = 64;
+constexpr std::size_t WorstVerified = 10;
+
+void texture_error::add(const char *before, const char *after, std::size_t blocks, bool dxt5) {
+    texels += 16 * static_cast<std::uint64_t>(blocks);
+    if (before == after) return;
+
+    const std::size_t size = dxt5 ? sizeof(dxt5_chunk) : 8;
+    char was[VerifyBatch * sizeof(dxt5_chunk)], now[VerifyBatch * sizeof(dxt5_chunk)];
+    std::uint8_t was_rgba[VerifyBatch * 64], now_rgba[VerifyBatch * 64];
+    std::size_t n = 0;
+    const auto compare = [&]() {
+        if (dxt5) {
+            decode_dxt5_blocks(was, n, was_rgba, true);
+            decode_dxt5_blocks(now, n, now_rgba);
+        } else {
+            decode_dxt1_blocks(was, n, was_rgba);
+            decode_dxt1_blocks(now, n, now_rgba);
+        }
+        for (std::size_t k = 0; k < n * 64; k += 4) {
+            for (std::size_t c = 0; c < 3; ++c) {
+                const unsigned d = was_rgba[k + c] > now_rgba[k + c] ? was_rgba[k + c] - now_rgba[k + c] : now_rgba[k + c] - was_rgba[k + c];
+                sum2 += d * d;
+                max = std::max(max, d);
+            }
+        }
+        n = 0;
+    };
+    for (std::size_t i = 0; i < blocks; ++i) {
+        const char *b = before + i * size, *a = after + i * size;
+        if (std::memcmp(b, a, size) == 0) {
+            // Ambiguous DXT5 blocks decode differently as intended even unchanged
+            if (!dxt5) continue;
+            std::uint16_t cs[2];
+            std::memcpy(cs, b + offsetof(dxt5_chunk, cs0), sizeof(cs));
+            if (cs[0] > cs[1]) continue;
+        }
+        std::memcpy(was + n * size, b, size);
+        std::memcpy(now + n * size, a, size);
+        if (++n == VerifyBatch) compare();
+    }
+    if (n != 0) compare();
+}
+
+double texture_error::rmse() const {
+    return texels != 0 ? std::sqrt(static_cast<double>(sum2) / (3.0 * static_cast<double>(texels))) : 0.0;
+}
+
+double texture_error::psnr() const {
+    if (sum2 == 0) return std::numeric_limits<double>::infinity();
+    return 10.0 * std::log10(255.0 * 255.0 * 3.0 * static_cast<double>(texels) / static_cast<double>(sum2));
+}
+
+texture_error &texture_error::operator+=(const texture_error &other) {
+    texels += other.texels;
+    sum2 += other.sum2;
+    max = std::max(max, other.max);
+    return *this;
+}
+
+void texture_error::print_line(std::ostream &out) const {
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2) << "max " << max << ", RMSE " << rmse() << ", PSNR ";
+    if (sum2 == 0) out << "inf";
+    else out << psnr() << " dB";
+    out.flags(flags), out.precision(precision);
+}
+
+void verify_texture(span<const char> before, span<const char> after, texture_error &error) {
+    tex_header header;
+    std::size_t bytes;
+    if (!dxt_layout(after, after.size(), header, bytes) || before.size() < bytes) return;
+    const std::size_t size = header.type == 26 ? sizeof(dxt5_chunk) : 8;
+    error.add(before.data() + sizeof(tex_header), after.data() + sizeof(tex_header), (bytes - sizeof(tex_header)) / size,
+              header.type == 26);
+}
+
+void verify_report::add(const std::string &name, const texture_error &texture) {
+    if (texture.empty()) return;
+    total += texture;
+    ++textures;
+    if (texture.sum2 == 0) return;
+    const auto larger = [](const std::pair<double, std::string> &a, const std::pair<double, std::string> &b) {
+        return a.first > b.first;
+    };
+    worst.insert(std::upper_bound(worst.begin(), worst.end(), std::make_pair(texture.rmse(), name), larger),
+                 std::make_pair(texture.rmse(), name));
+    if (worst.size() > WorstVerified) worst.pop_back();
+}
+
+void verify_report::print(std::ostream &out) const {
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << "Verify: " << textures << " patched textures, " << total.texels << " texels; ";
+    total.print_line(out);
+    out << '\n';
+    if (!worst.empty()) {
+        out << std::fixed << std::setprecision(2) << "Largest RMSE:" << '\n';
+        for (const auto &texture : worst) out << "  " << std::setw(8) << texture.first << "  " << texture.second << '\n';
+    }
+    out << std::flush;
+    out.flags(flags), out.precision(precision);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "span.hpp"
+
+// How far a fixed texture is from its original, decoded as intended (see
+// decode_dxt5_blocks), over the R, G and B of every texel kept
+struct texture_error {
+    std::uint64_t texels = 0, sum2 = 0; // sum2 of the channel differences
+    unsigned max = 0;                   // largest channel difference
+
+    // blocks of DXT5 (or DXT1) data before and after the fix. Blocks that
+    // are the same and unambiguous decode the same, and are only counted.
+    void add(const char *before, const char *after, std::size_t blocks, bool dxt5);
+
+    bool empty() const { return texels == 0; }
+    double rmse() const;
+    double psnr() const; // dB; infinite when nothing changed
+    texture_error &operator+=(const texture_error &other);
+    // One line: max, RMSE and PSNR
+    void print_line(std::ostream &out) const;
+};
+
+// Adds to error every mip level after keeps, compared with the same blocks
+// of before. after is what fix_dxt gave for before, a type 22 or 26 texture.
+void verify_texture(span<const char> before, span<const char> after, texture_error &error);
+
+// --verify over one archive: every texture's error, and the textures the
+// fix changed the most
+class verify_report {
+public:
+    void add(const std::string &name, const texture_error &texture);
+    void print(std::ostream &out) const;
+
+private:
+    texture_error total;
+    std::size_t textures = 0;
+    std::vector<std::pair<double, std::string>> worst; // RMSE and name, largest first
+};
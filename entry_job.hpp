@@ -0,0 +1,50 @@
+#pragma once
+
+// Per-entry state of the processing pipeline, shared by dat_proc and the
+// dat_archive API. Internal to the library.
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+#include "dat_format.hpp"
+#include "dxt_verify.hpp"
+#include "solver_counters.hpp"
+#include "span.hpp"
+
+class dat_manifest;
+struct manifest_entry;
+class thread_pool;
+
+struct entry_job {
+    file_info &file;
+    span<const char> name; // into the archive's name_table
+    span<const char> payload; // compressed data to be written
+    std::vector<char> data, buffer;
+    bool checked = false, patched = false;
+
+    const dat_manifest *cache = nullptr;
+    const manifest_entry *cached = nullptr;
+    std::uint64_t hash = 0;
+
+    thread_pool *search = nullptr;  // runs the --optimize candidates
+    thread_pool *helpers = nullptr; // idle ones take a share of fix_dxt on big textures
+    std::size_t baseline = 0;      // size the plain settings gave, 0 if stored
+
+    const file_info *same_as = nullptr; // --dedup: earlier entry with the same payload, whose result this one takes
+
+    texture_error verify; // --verify
+
+#ifdef MC2_SOLVER_COUNTERS
+    solver_counters solver; // --solver-stats
+#endif
+
+    entry_job(file_info &file) : file(file) { }
+};
+
+bool is_texture_name(span<const char> name);
+
+// Inflates the loaded payload of a texture entry, fixes it and deflates it
+// again if anything changed. file and payload then describe the new data.
+void process_texture(entry_job &job);
@@ -2,11 +2,17 @@
 
 #include <cstddef>
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <iterator>
+#include <limits>
 #include <utility>
 
 #include "fix_dxt.hpp"
 #include "mc2_exception.hpp"
+#include "simd.hpp"
+#include "solver_counters.hpp"
 
 template<class T> constexpr const T& clamp(const T& v, const T& lo, const T& hi) { return v < lo ? lo : hi < v ? hi : v; }
 
@@ -112,57 +118,109 @@ public:
     static constexpr bool compare_err(eval a, eval b) { return a.err2 < b.err2; }
 };
 
-constexpr std::array<std::int_fast8_t, 4> invertCs(const std::array<std::int_fast8_t, 4> w) {
-    return { w[1], w[0], w[2], w[3] };
-}
+// Rounded division (Num + Den / 2) / Den, truncating toward zero like
+// the integer division it replaces, done as a multiply and shift.
+// Exact while |Num + Den / 2| * (mul * Den - 2^32) < 2^32, which holds
+// for |Num| < 2^17 and Den < 2^11 (checked on dist_table below).
+class rdiv {
+public:
+    constexpr rdiv() : den(1), half(0), mul(0) { }
+    constexpr rdiv(int den) : den(den), half(den / 2),
+        mul(((static_cast<std::uint64_t>(1) << 32) + static_cast<std::uint64_t>(den) - 1) / static_cast<std::uint64_t>(den)) { }
+
+    constexpr int operator()(int num) const {
+        return num + half >= 0 ? static_cast<int>((static_cast<std::uint64_t>(num + half) * mul) >> 32)
+                               : -static_cast<int>((static_cast<std::uint64_t>(-(num + half)) * mul) >> 32);
+    }
+
+    int den, half;
+    std::uint64_t mul;
+};
+
+// Everything iiix and iixi derive from a block's weight distribution
+// (w0, w1, w2), w0 + w1 + w2 == 16. Only a few hundred exist, so
+// they are all computed at compile time. The inverted encodings
+// (cs0 and cs1 swapped) use the entry for (w1, w0, w2).
+struct dist_consts {
+    // iixi
+    int w0w1, w0w2, w1w2, K;
+    rdiv byK;
+    // iiix fallback: (a1 * iiix_a1 + a2 * iiix_a2 - x * iiix_x) / (9w0 + w1 + 4w2)
+    int iiix_a1, iiix_a2, iiix_x;
+    rdiv iiix_den;
+    // iixi fallback: (a1 * iixi_a1 + (a1 + a2) * iixi_a12 - x * iixi_x) / (9w0 + 4w2)
+    int iixi_a1, iixi_a12, iixi_x;
+    rdiv iixi_den;
+
+    constexpr dist_consts() : w0w1(0), w0w2(0), w1w2(0), K(0), iiix_a1(0), iiix_a2(0), iiix_x(0),
+        iixi_a1(0), iixi_a12(0), iixi_x(0) { }
+    constexpr dist_consts(int w0, int w1, int w2) :
+        w0w1(w0 * w1), w0w2(w0 * w2), w1w2(w1 * w2), K(18 * w0w1 + 2 * w0w2 + 8 * w1w2), byK(K > 0 ? K : 1),
+        iiix_a1(3 * (3 * w0 + w2)), iiix_a2(3 * (w1 + w2)), iiix_x(2 * (w1 + w2)),
+        iiix_den(9 * w0 + w1 + 4 * w2 > 0 ? 9 * w0 + w1 + 4 * w2 : 1),
+        iixi_a1(9 * w0), iixi_a12(3 * w2), iixi_x(2 * w2),
+        iixi_den(9 * w0 + 4 * w2 > 0 ? 9 * w0 + 4 * w2 : 1) { }
+};
+
+struct dist_table {
+    dist_consts v[17][17]; // [w0][w1]
+
+    constexpr const dist_consts &operator()(int w0, int w1) const { return v[w0][w1]; }
+};
 
-constexpr int rdiv(int Num, int Den, int DenH) { return (Num + DenH) / Den; }
+constexpr dist_table make_dist_table() {
+    dist_table t{};
+    for (int w0 = 0; w0 <= 16; ++w0)
+        for (int w1 = 0; w0 + w1 <= 16; ++w1)
+            t.v[w0][w1] = dist_consts(w0, w1, 16 - w0 - w1);
+    return t;
+}
 
-constexpr int rdiv(int Num, int Den) { return (Num + Den / 2) / Den; }
+constexpr dist_table DistTable = make_dist_table();
+
+constexpr bool check_dist_table() {
+    for (int w0 = 0; w0 <= 16; ++w0)
+        for (int w1 = 0; w1 <= 16; ++w1) {
+            const dist_consts &c = DistTable(w0, w1);
+            if (c.byK.den >= 1 << 11 || c.iiix_den.den >= 1 << 11 || c.iixi_den.den >= 1 << 11) return false;
+            // largest magnitude of any numerator for 6-bit channels
+            if (64 * (c.K + c.w0w2 + 2 * c.w1w2) >= 1 << 17) return false;
+            if (64 * (c.iiix_a1 + c.iiix_a2 + c.iiix_x) >= 1 << 17) return false;
+            if (64 * (c.iixi_a1 + 2 * c.iixi_a12 + c.iixi_x) >= 1 << 17) return false;
+            // the batch solver keeps reciprocals of three color blocks in 32 bits
+            if (w0 > 0 && w1 > 0 && w0 + w1 < 16 &&
+                (c.byK.mul >> 32 != 0 || c.iiix_den.mul >> 32 != 0 || c.iixi_den.mul >> 32 != 0)) return false;
+        }
+    return true;
+}
+static_assert(check_dist_table(), "rdiv reciprocals are not exact for every distribution");
 
-static std::pair<color, color> iiix(color cs0, color cs1, const std::array<std::int_fast8_t, 4> w) {
+static std::pair<color, color> iiix(color cs0, color cs1, const dist_consts &c) {
     color b = color::mix(cs0, cs1, [](int a, int b) -> int { return b + (b - a) / 2; });
     if (b.isValid()) {
         return { cs0, b };
     }
 
     b = b.clamp();
-    color a = color::complex(cs0, cs1, b, [w](int a1, int a2, int x) -> int {
-        return rdiv(3 * (3 * w[0] + w[2])*a1 + 3 * (w[1] + w[2])*a2 - 2 * (w[1] + w[2])*x,
-                    9 * w[0] + w[1] + 4 * w[2]);
+    color a = color::complex(cs0, cs1, b, [&c](int a1, int a2, int x) -> int {
+        return c.iiix_den(c.iiix_a1 * a1 + c.iiix_a2 * a2 - c.iiix_x * x);
     });
 
     return { a, b };
 }
 
-class iixi_store {
-public:
-    const int w0w1, w0w2, w1w2, K, Kh;
-
-    constexpr iixi_store(const std::array<std::int_fast8_t, 4> w) :
-        w0w1(w[0] * w[1]), w0w2(w[0] * w[2]), w1w2(w[1] * w[2]),
-        K(18 * w0w1 + 2 * w0w2 + 8 * w1w2), Kh(K / 2) { }
-    constexpr iixi_store invert() const { return iixi_store(w0w1, w1w2, w0w2); }
-
-private:
-    constexpr iixi_store(int w0w1, int w0w2, int w1w2) :
-        w0w1(w0w1), w0w2(w0w2), w1w2(w1w2),
-        K(18 * w0w1 + 2 * w0w2 + 8 * w1w2), Kh(K / 2) { }
-};
-
-static std::pair<color, color> iixi(color cs0, color cs1, const std::array<std::int_fast8_t, 4> w, iixi_store s) {
-    color a, b = color::mix(cs0, cs1, [s](int a1, int a2) -> int {
-        return rdiv(s.K * a2 + s.w0w2 * (a2 - a1), s.K, s.Kh);
+static std::pair<color, color> iixi(color cs0, color cs1, const dist_consts &c) {
+    color a, b = color::mix(cs0, cs1, [&c](int a1, int a2) -> int {
+        return c.byK(c.K * a2 + c.w0w2 * (a2 - a1));
     });
     if (b.isValid()) {
-        a = color::mix(cs0, cs1, [s](int a1, int a2) -> int {
-            return rdiv(s.K * a1 + 2 * s.w1w2 * (a2 - a1), s.K, s.Kh);
+        a = color::mix(cs0, cs1, [&c](int a1, int a2) -> int {
+            return c.byK(c.K * a1 + 2 * c.w1w2 * (a2 - a1));
         });
     } else {
         b = b.clamp();
-        a = color::complex(cs0, cs1, b, [w](int a1, int a2, int x) -> int {
-            return rdiv(9 * w[0] * a1 + 3 * w[2] * (a1 + a2) - 2 * w[2] * x,
-                        9 * w[0] + 4 * w[2]);
+        a = color::complex(cs0, cs1, b, [&c](int a1, int a2, int x) -> int {
+            return c.iixi_den(c.iixi_a1 * a1 + c.iixi_a12 * (a1 + a2) - c.iixi_x * x);
         });
     }
 
@@ -174,6 +232,7 @@ static void handle1(color &cs0, color &cs1, std::uint32_t &cv) {
     color lower = color::mix(cs0, cs1, [](int a, int b) -> int { return (a + b) / 2; });
     color upper = color::mix(cs0, cs1, [](int a, int b) -> int { return (a + b + 1) / 2; });
     cs0 = upper, cs1 = lower;
+    count_path(solver_path::squeeze);
 }
 
 static void handle2(color &cs0, color &cs1, std::uint32_t &cv, std::int_fast8_t w2) {
@@ -182,6 +241,7 @@ static void handle2(color &cs0, color &cs1, std::uint32_t &cv, std::int_fast8_t
     color x = color::mix(cs0, cs1, [](int a, int b) -> int { return b + (b - a) / 2; });
     if (x.isValid()) {
         cs1 = x;
+        count_path(solver_path::outer);
         return; // (00b, 10b) to (00b, 10b)
     }
     
@@ -190,32 +250,39 @@ static void handle2(color &cs0, color &cs1, std::uint32_t &cv, std::int_fast8_t
     // (I tried pre-computing this, but to make changes to
     //  single_error2 easier, I didn't keep that code)
     pre_eval_p2 pre(w2, cs0, cs1);
-    eval best = std::min({
+    const eval candidates[] = {
         eval(cs0, color::mix(cs0, cs1, [](int a, int b) -> int { return (b + a) / 2; }),
              cv >> 1 /* (00b, 10b) to (00b, 01b) */, pre, mixer::t0, mixer::t1), // ixxi
         eval(cs0, color::mix(cs0, cs1, [](int a, int b) -> int { return (3*b + a + 1) / 4; }),
              cv | (cv >> 1) /* (00b, 10b) to (00b, 11b) */, pre, mixer::t0, mixer::t3), // ixix
         eval(color::mix(cs0, cs1, [](int a, int b) -> int { return a - (b - a) / 2; }), cs1,
              (cv >> 1) | 0xAAAAAAAA /* (00b, 10b) to (10b, 11b) */, pre, mixer::t2, mixer::t3), // xiix
-    }, eval::compare_err);
+    };
+    // The first of the smallest, as std::min
+    const eval &best = *std::min_element(std::begin(candidates), std::end(candidates), eval::compare_err);
+    count_path(solver_path::two);
+    count_pick(static_cast<solver_pick>(static_cast<int>(solver_pick::ixxi) + (&best - candidates)), best.err2);
     
     cs0 = best.b1, cs1 = best.b2, cv = best.cv;
 }
 
 static void handle3(color &cs0, color &cs1, std::uint32_t &cv, const std::array<std::int_fast8_t, 4> w) {
-    iixi_store s(w);
+    const dist_consts &c = DistTable(w[0], w[1]), &ci = DistTable(w[1], w[0]);
     pre_eval_p3 p3(w, cs0, cs1);
 
-    eval best = std::min({
-        eval(iiix(cs0, cs1, w), cv | ((cv << 1) & 0xAAAAAAAA) /* (00b, 01b, 10b) to (00b, 11b, 10b) */,
+    const eval candidates[] = {
+        eval(iiix(cs0, cs1, c), cv | ((cv << 1) & 0xAAAAAAAA) /* (00b, 01b, 10b) to (00b, 11b, 10b) */,
             p3, mixer::t0, mixer::t3, mixer::t2), // iiix
-        eval(iiix(cs1, cs0, invertCs(w)), (cv ^ 0x55555555) | ((cv << 1) & 0xAAAAAAAA) /* (00b, 01b, 10b) to (01b, 10b, 11b) */,
+        eval(iiix(cs1, cs0, ci), (cv ^ 0x55555555) | ((cv << 1) & 0xAAAAAAAA) /* (00b, 01b, 10b) to (01b, 10b, 11b) */,
             p3.invert(), mixer::t2, mixer::t1, mixer::t3), // xiii
-        eval(iixi(cs0, cs1, w, s), cv /* (00b, 01b, 10b) to (00b, 01b, 10b) */,
+        eval(iixi(cs0, cs1, c), cv /* (00b, 01b, 10b) to (00b, 01b, 10b) */,
             p3, mixer::t0, mixer::t1, mixer::t2), // iixi
-        eval(iixi(cs1, cs0, invertCs(w), s.invert()), cv ^ 0x55555555 /* (00b, 01b, 10b) to (01b, 00b, 11b) */,
+        eval(iixi(cs1, cs0, ci), cv ^ 0x55555555 /* (00b, 01b, 10b) to (01b, 00b, 11b) */,
             p3.invert(), mixer::t0, mixer::t1, mixer::t3), // ixii
-    }, eval::compare_err);
+    };
+    const eval &best = *std::min_element(std::begin(candidates), std::end(candidates), eval::compare_err);
+    count_path(solver_path::three);
+    count_pick(static_cast<solver_pick>(&best - candidates), best.err2);
 
     cs0 = best.b1, cs1 = best.b2, cv = best.cv;
 }
@@ -249,3 +316,445 @@ void fix_block(dxt5_chunk &chunk) {
     }
     chunk.setColors(cs);
 }
+
+/*
+ * Batched solver: fix_blocks sorts the blocks by how many colors they
+ * use and gathers them lane by lane (structure of arrays), so the
+ * candidate encodings of handle2 and handle3 are evaluated for 8 blocks
+ * per instruction. The numerators of iiix / iixi reach 2^17 and the
+ * error sums 2^28, so lanes are 32-bit. Every step mirrors the scalar
+ * code above, including its rounding and its order on ties.
+ */
+namespace {
+    constexpr std::size_t BatchLanes = 16;
+
+    // Blocks with the same number of colors, lane by lane. a1 / a2 are
+    // cs0 / cs1 per channel on the way in, and the new ones on the way out.
+    struct block_batch {
+        std::int32_t a1[3][BatchLanes], a2[3][BatchLanes];
+        std::int32_t w[3][BatchLanes];
+        std::uint32_t cv[BatchLanes];
+        dxt5_chunk *chunk[BatchLanes];
+        std::size_t size = 0;
+
+        void load(dxt5_chunk &block, color cs0, color cs1, const std::array<std::int_fast8_t, 4> &dist) {
+            const std::size_t i = size++;
+            for (std::size_t ch = 0; ch < 3; ++ch) a1[ch][i] = cs0[ch], a2[ch][i] = cs1[ch], w[ch][i] = dist[ch];
+            cv[i] = block.cv;
+            chunk[i] = &block;
+        }
+
+        void store() {
+            for (std::size_t i = 0; i < size; ++i) {
+                chunk[i]->cv = cv[i];
+                chunk[i]->setColors({ { a1[0][i], a1[1][i], a1[2][i] }, { a2[0][i], a2[1][i], a2[2][i] } });
+            }
+            size = 0;
+        }
+    };
+
+    typedef void (*solve_fn)(block_batch &batch);
+
+    // Lane by lane through the scalar solver, where there is no vector path
+    void solve2_scalar(block_batch &batch) {
+        for (std::size_t i = 0; i < batch.size; ++i) {
+            color cs0 = { batch.a1[0][i], batch.a1[1][i], batch.a1[2][i] }, cs1 = { batch.a2[0][i], batch.a2[1][i], batch.a2[2][i] };
+            handle2(cs0, cs1, batch.cv[i], static_cast<std::int_fast8_t>(batch.w[2][i]));
+            for (std::size_t ch = 0; ch < 3; ++ch) batch.a1[ch][i] = cs0[ch], batch.a2[ch][i] = cs1[ch];
+        }
+    }
+
+    void solve3_scalar(block_batch &batch) {
+        for (std::size_t i = 0; i < batch.size; ++i) {
+            color cs0 = { batch.a1[0][i], batch.a1[1][i], batch.a1[2][i] }, cs1 = { batch.a2[0][i], batch.a2[1][i], batch.a2[2][i] };
+            const std::array<std::int_fast8_t, 4> w = { static_cast<std::int_fast8_t>(batch.w[0][i]),
+                static_cast<std::int_fast8_t>(batch.w[1][i]), static_cast<std::int_fast8_t>(batch.w[2][i]), 0 };
+            handle3(cs0, cs1, batch.cv[i], w);
+            for (std::size_t ch = 0; ch < 3; ++ch) batch.a1[ch][i] = cs0[ch], batch.a2[ch][i] = cs1[ch];
+        }
+    }
+}
+
+#ifdef MC2_SIMD_X86
+
+namespace {
+    // A color in 8 lanes
+    struct vcolor { __m256i v[3]; };
+
+    MC2_TARGET_AVX2 inline __m256i vload(const std::int32_t *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+    MC2_TARGET_AVX2 inline __m256i vload(const std::uint32_t *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+    MC2_TARGET_AVX2 inline void vstore(std::int32_t *p, __m256i v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v); }
+    MC2_TARGET_AVX2 inline void vstore(std::uint32_t *p, __m256i v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v); }
+
+    MC2_TARGET_AVX2 inline __m256i vadd(__m256i a, __m256i b) { return _mm256_add_epi32(a, b); }
+    MC2_TARGET_AVX2 inline __m256i vsub(__m256i a, __m256i b) { return _mm256_sub_epi32(a, b); }
+    MC2_TARGET_AVX2 inline __m256i vmul(__m256i a, __m256i b) { return _mm256_mullo_epi32(a, b); }
+    MC2_TARGET_AVX2 inline __m256i vmul(__m256i a, int k) { return _mm256_mullo_epi32(a, _mm256_set1_epi32(k)); }
+
+    // x / 2^shift, truncated toward zero like integer division
+    template<int shift> MC2_TARGET_AVX2 inline __m256i vdiv_pow2(__m256i x) {
+        const __m256i bias = _mm256_srli_epi32(_mm256_srai_epi32(x, 31), 32 - shift);
+        return _mm256_srai_epi32(_mm256_add_epi32(x, bias), shift);
+    }
+
+    // rdiv with a 32-bit reciprocal: high half of |num + half| * mul, sign restored
+    MC2_TARGET_AVX2 inline __m256i vrdiv(__m256i num, __m256i half, __m256i mul) {
+        const __m256i n = _mm256_add_epi32(num, half);
+        const __m256i sign = _mm256_srai_epi32(n, 31);
+        const __m256i abs = _mm256_sub_epi32(_mm256_xor_si256(n, sign), sign);
+        const __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(abs, mul), 32);
+        const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(abs, 32), _mm256_srli_epi64(mul, 32));
+        const __m256i q = _mm256_blend_epi32(even, odd, 0xAA);
+        return _mm256_sub_epi32(_mm256_xor_si256(q, sign), sign);
+    }
+
+    MC2_TARGET_AVX2 inline vcolor vload(const std::int32_t (&c)[3][BatchLanes], std::size_t at) {
+        return { { vload(c[0] + at), vload(c[1] + at), vload(c[2] + at) } };
+    }
+    MC2_TARGET_AVX2 inline void vstore(std::int32_t (&c)[3][BatchLanes], std::size_t at, const vcolor &v) {
+        for (std::size_t ch = 0; ch < 3; ++ch) vstore(c[ch] + at, v.v[ch]);
+    }
+
+    // The same f(a, b) of every channel, as color::mix
+    typedef __m256i (*vchannel_fn)(__m256i, __m256i);
+    template<vchannel_fn f> MC2_TARGET_AVX2 inline vcolor vmix(const vcolor &a, const vcolor &b) {
+        return { { f(a.v[0], b.v[0]), f(a.v[1], b.v[1]), f(a.v[2], b.v[2]) } };
+    }
+
+    // b + (b - a) / 2, the extrapolation of iixx and iiix
+    MC2_TARGET_AVX2 inline __m256i vbeyond(__m256i a, __m256i b) { return vadd(b, vdiv_pow2<1>(vsub(b, a))); }
+    // a - (b - a) / 2, xiix
+    MC2_TARGET_AVX2 inline __m256i vbefore(__m256i a, __m256i b) { return vsub(a, vdiv_pow2<1>(vsub(b, a))); }
+    // (b + a) / 2, ixxi
+    MC2_TARGET_AVX2 inline __m256i vmiddle(__m256i a, __m256i b) { return vdiv_pow2<1>(vadd(b, a)); }
+    // (3b + a + 1) / 4, ixix
+    MC2_TARGET_AVX2 inline __m256i vquarter(__m256i a, __m256i b) {
+        return vdiv_pow2<2>(vadd(vadd(vmul(b, 3), a), _mm256_set1_epi32(1)));
+    }
+
+    // color::isValid as a lane mask
+    MC2_TARGET_AVX2 inline __m256i vvalid(const vcolor &c) {
+        const __m256i negative = _mm256_set1_epi32(-1);
+        __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi32(c.v[0], negative), _mm256_cmpgt_epi32(_mm256_set1_epi32(0x20), c.v[0]));
+        ok = _mm256_and_si256(ok, _mm256_and_si256(_mm256_cmpgt_epi32(c.v[1], negative), _mm256_cmpgt_epi32(_mm256_set1_epi32(0x40), c.v[1])));
+        return _mm256_and_si256(ok, _mm256_and_si256(_mm256_cmpgt_epi32(c.v[2], negative), _mm256_cmpgt_epi32(_mm256_set1_epi32(0x20), c.v[2])));
+    }
+
+    MC2_TARGET_AVX2 inline vcolor vclamp(const vcolor &c) {
+        const __m256i zero = _mm256_setzero_si256();
+        return { { _mm256_min_epi32(_mm256_max_epi32(c.v[0], zero), _mm256_set1_epi32(0x1F)),
+                   _mm256_min_epi32(_mm256_max_epi32(c.v[1], zero), _mm256_set1_epi32(0x3F)),
+                   _mm256_min_epi32(_mm256_max_epi32(c.v[2], zero), _mm256_set1_epi32(0x1F)) } };
+    }
+
+    // Lanes of b where mask is set, of a elsewhere
+    MC2_TARGET_AVX2 inline vcolor vselect(const vcolor &a, const vcolor &b, __m256i mask) {
+        return { { _mm256_blendv_epi8(a.v[0], b.v[0], mask), _mm256_blendv_epi8(a.v[1], b.v[1], mask),
+                   _mm256_blendv_epi8(a.v[2], b.v[2], mask) } };
+    }
+
+    // single_error2
+    MC2_TARGET_AVX2 inline __m256i verror2(const vcolor &x, const vcolor &y) {
+        const __m256i r = vsub(y.v[0], x.v[0]), g = vsub(y.v[1], x.v[1]), b = vsub(y.v[2], x.v[2]);
+        return vadd(vadd(vmul(vmul(r, r), 2), vmul(g, g)), vmul(vmul(b, b), 3));
+    }
+
+    // The mixer functions for two endpoints b1, b2: weights of b1 and b2 out of 6
+    MC2_TARGET_AVX2 inline vcolor vmixer(const vcolor &b1, const vcolor &b2, int k1, int k2) {
+        vcolor out;
+        for (std::size_t ch = 0; ch < 3; ++ch)
+            out.v[ch] = k2 == 0 ? vmul(b1.v[ch], k1) : k1 == 0 ? vmul(b2.v[ch], k2) : vadd(vmul(b1.v[ch], k1), vmul(b2.v[ch], k2));
+        return out;
+    }
+
+    // rdiv::mul of every denominator dist_table has, cut to 32 bits
+    struct reciprocal_table {
+        std::uint32_t v[1 << 11];
+    };
+
+    constexpr reciprocal_table make_reciprocal_table() {
+        reciprocal_table t{};
+        for (int den = 1; den < 1 << 11; ++den) t.v[den] = static_cast<std::uint32_t>(rdiv(den).mul);
+        return t;
+    }
+
+    constexpr reciprocal_table Reciprocals = make_reciprocal_table();
+
+    // dist_consts of 8 lanes, worked out from their weights; cheaper than
+    // gathering them from dist_table, apart from the reciprocals
+    struct vdist {
+        __m256i K, w0w2, w1w2, kHalf, kMul, iiixA1, iiixA2, iiixX, iiixHalf, iiixMul, iixiA1, iixiA12, iixiX, iixiHalf, iixiMul;
+    };
+
+    MC2_TARGET_AVX2 inline __m256i vreciprocal(__m256i den) {
+        return _mm256_i32gather_epi32(reinterpret_cast<const int *>(Reciprocals.v), den, 4);
+    }
+
+    MC2_TARGET_AVX2 inline vdist vconsts(__m256i w0, __m256i w1, __m256i w2) {
+        vdist c;
+        c.w0w2 = vmul(w0, w2), c.w1w2 = vmul(w1, w2);
+        c.K = vadd(vadd(vmul(vmul(w0, w1), 18), vmul(c.w0w2, 2)), vmul(c.w1w2, 8));
+        c.kHalf = _mm256_srli_epi32(c.K, 1), c.kMul = vreciprocal(c.K);
+        const __m256i w12 = vadd(w1, w2), nine0 = vmul(w0, 9);
+        c.iiixA1 = vmul(vadd(vmul(w0, 3), w2), 3), c.iiixA2 = vmul(w12, 3), c.iiixX = vmul(w12, 2);
+        const __m256i iiixDen = vadd(vadd(nine0, w1), vmul(w2, 4));
+        c.iiixHalf = _mm256_srli_epi32(iiixDen, 1), c.iiixMul = vreciprocal(iiixDen);
+        c.iixiA1 = nine0, c.iixiA12 = vmul(w2, 3), c.iixiX = vmul(w2, 2);
+        const __m256i iixiDen = vadd(nine0, vmul(w2, 4));
+        c.iixiHalf = _mm256_srli_epi32(iixiDen, 1), c.iixiMul = vreciprocal(iixiDen);
+        return c;
+    }
+
+    // iiix and iixi above, with the valid / fallback branch as a select
+    MC2_TARGET_AVX2 inline void viiix(const vcolor &a1, const vcolor &a2, const vdist &c, vcolor &a, vcolor &b) {
+        const vcolor x = vmix<vbeyond>(a1, a2);
+        const __m256i valid = vvalid(x);
+        b = vclamp(x);
+        vcolor fallback;
+        for (std::size_t ch = 0; ch < 3; ++ch) {
+            const __m256i num = vsub(vadd(vmul(c.iiixA1, a1.v[ch]), vmul(c.iiixA2, a2.v[ch])), vmul(c.iiixX, b.v[ch]));
+            fallback.v[ch] = vrdiv(num, c.iiixHalf, c.iiixMul);
+        }
+        a = vselect(fallback, a1, valid);
+    }
+
+    MC2_TARGET_AVX2 inline void viixi(const vcolor &a1, const vcolor &a2, const vdist &c, vcolor &a, vcolor &b) {
+        vcolor x, inner, fallback;
+        for (std::size_t ch = 0; ch < 3; ++ch) {
+            const __m256i d = vsub(a2.v[ch], a1.v[ch]);
+            x.v[ch] = vrdiv(vadd(vmul(c.K, a2.v[ch]), vmul(c.w0w2, d)), c.kHalf, c.kMul);
+            inner.v[ch] = vrdiv(vadd(vmul(c.K, a1.v[ch]), vmul(vmul(c.w1w2, d), 2)), c.kHalf, c.kMul);
+        }
+        const __m256i valid = vvalid(x);
+        b = vclamp(x);
+        for (std::size_t ch = 0; ch < 3; ++ch) {
+            const __m256i num = vsub(vadd(vmul(c.iixiA1, a1.v[ch]), vmul(c.iixiA12, vadd(a1.v[ch], a2.v[ch]))), vmul(c.iixiX, b.v[ch]));
+            fallback.v[ch] = vrdiv(num, c.iixiHalf, c.iixiMul);
+        }
+        a = vselect(fallback, inner, valid);
+    }
+
+    // Running minimum over the candidates in order, so ties keep the earlier one like std::min.
+    // pick, the solver_pick of the minimum, is only kept for the solver counters.
+    struct vbest {
+        __m256i err2, cv;
+        vcolor b1, b2;
+#ifdef MC2_SOLVER_COUNTERS
+        __m256i pick;
+#endif
+
+        MC2_TARGET_AVX2 void first(solver_pick p, __m256i e, __m256i v, const vcolor &c1, const vcolor &c2) {
+            err2 = e, cv = v, b1 = c1, b2 = c2;
+#ifdef MC2_SOLVER_COUNTERS
+            pick = _mm256_set1_epi32(static_cast<int>(p));
+#else
+            (void) p;
+#endif
+        }
+
+        MC2_TARGET_AVX2 void offer(solver_pick p, __m256i e, __m256i v, const vcolor &c1, const vcolor &c2) {
+            const __m256i better = _mm256_cmpgt_epi32(err2, e);
+            err2 = _mm256_blendv_epi8(err2, e, better);
+            cv = _mm256_blendv_epi8(cv, v, better);
+            b1 = vselect(b1, c1, better);
+            b2 = vselect(b2, c2, better);
+#ifdef MC2_SOLVER_COUNTERS
+            pick = _mm256_blendv_epi8(pick, _mm256_set1_epi32(static_cast<int>(p)), better);
+#else
+            (void) p;
+#endif
+        }
+
+#ifdef MC2_SOLVER_COUNTERS
+        // Counts the first lanes of the batch; those where keep is set took path instead of a pick
+        MC2_TARGET_AVX2 void count(std::size_t lanes, solver_path picked, __m256i keep, solver_path kept) const {
+            if (Solver_Counts == nullptr) return;
+            std::int32_t e[8], p[8], k[8];
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(e), err2);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), pick);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(k), keep);
+            for (std::size_t i = 0; i < lanes && i < 8; ++i) {
+                if (k[i] != 0) {
+                    count_path(kept);
+                    continue;
+                }
+                count_path(picked);
+                count_pick(static_cast<solver_pick>(p[i]), static_cast<std::uint32_t>(e[i]));
+            }
+        }
+#endif
+    };
+
+    // w0 * e0 + w1 * e1 + w2 * e2 over the three weighted colors
+    MC2_TARGET_AVX2 inline __m256i vtotal3(const __m256i (&w)[3], const vcolor &x0, const vcolor &h0,
+                                           const vcolor &x1, const vcolor &h1, const vcolor &x2, const vcolor &h2) {
+        return vadd(vadd(vmul(w[0], verror2(x0, h0)), vmul(w[1], verror2(x1, h1))), vmul(w[2], verror2(x2, h2)));
+    }
+
+    // eval's two color error, the largest error if b1 or b2 can't be stored
+    MC2_TARGET_AVX2 inline __m256i vtotal2(__m256i w0, __m256i w2, const vcolor &b1, const vcolor &b2,
+                                           const vcolor &x0, const vcolor &h0, const vcolor &x2, const vcolor &h2) {
+        const __m256i e = vadd(vmul(w0, verror2(x0, h0)), vmul(w2, verror2(x2, h2)));
+        return _mm256_blendv_epi8(_mm256_set1_epi32(0x7FFFFFFF), e, _mm256_and_si256(vvalid(b1), vvalid(b2)));
+    }
+
+    MC2_TARGET_AVX2 void solve3_avx2(block_batch &batch) {
+        const __m256i odd = _mm256_set1_epi32(0x55555555), even = _mm256_set1_epi32(static_cast<int>(0xAAAAAAAA));
+        for (std::size_t at = 0; at < batch.size; at += 8) {
+            const vcolor a1 = vload(batch.a1, at), a2 = vload(batch.a2, at);
+            const __m256i w[3] = { vload(batch.w[0] + at), vload(batch.w[1] + at), vload(batch.w[2] + at) };
+            const __m256i cv = vload(batch.cv + at), up = _mm256_and_si256(_mm256_slli_epi32(cv, 1), even);
+            const vdist c = vconsts(w[0], w[1], w[2]), ci = vconsts(w[1], w[0], w[2]);
+
+            // pre_eval_p3; the inverted encodings swap h0 and h1
+            const vcolor h0 = vmixer(a1, a2, 6, 0), h1 = vmixer(a1, a2, 0, 6), h2 = vmixer(a1, a2, 3, 3);
+
+            vcolor p, q;
+            vbest best;
+            viiix(a1, a2, c, p, q); // iiix
+            best.first(solver_pick::iiix, vtotal3(w, vmixer(p, q, 6, 0), h0, vmixer(p, q, 2, 4), h1, vmixer(p, q, 4, 2), h2),
+                       _mm256_or_si256(cv, up), p, q);
+            viiix(a2, a1, ci, p, q); // xiii
+            best.offer(solver_pick::xiii, vtotal3(w, vmixer(p, q, 4, 2), h1, vmixer(p, q, 0, 6), h0, vmixer(p, q, 2, 4), h2),
+                       _mm256_or_si256(_mm256_xor_si256(cv, odd), up), p, q);
+            viixi(a1, a2, c, p, q); // iixi
+            best.offer(solver_pick::iixi, vtotal3(w, vmixer(p, q, 6, 0), h0, vmixer(p, q, 0, 6), h1, vmixer(p, q, 4, 2), h2), cv, p, q);
+            viixi(a2, a1, ci, p, q); // ixii
+            best.offer(solver_pick::ixii, vtotal3(w, vmixer(p, q, 6, 0), h1, vmixer(p, q, 0, 6), h0, vmixer(p, q, 2, 4), h2),
+                       _mm256_xor_si256(cv, odd), p, q);
+#ifdef MC2_SOLVER_COUNTERS
+            best.count(batch.size - at, solver_path::three, _mm256_setzero_si256(), solver_path::three);
+#endif
+
+            vstore(batch.a1, at, best.b1), vstore(batch.a2, at, best.b2);
+            vstore(batch.cv + at, best.cv);
+        }
+    }
+
+    MC2_TARGET_AVX2 void solve2_avx2(block_batch &batch) {
+        for (std::size_t at = 0; at < batch.size; at += 8) {
+            const vcolor a1 = vload(batch.a1, at), a2 = vload(batch.a2, at);
+            const __m256i w2 = vload(batch.w[2] + at), w0 = vsub(_mm256_set1_epi32(16), w2);
+            const __m256i cv = vload(batch.cv + at);
+
+            // iixx, kept wherever it is valid
+            const vcolor x = vmix<vbeyond>(a1, a2);
+            const __m256i outer = vvalid(x);
+
+            // pre_eval_p2
+            const vcolor h0 = vmixer(a1, a2, 6, 0), h2 = vmixer(a1, a2, 3, 3);
+
+            vbest best;
+            vcolor q = vmix<vmiddle>(a1, a2); // ixxi
+            best.first(solver_pick::ixxi, vtotal2(w0, w2, a1, q, vmixer(a1, q, 6, 0), h0, vmixer(a1, q, 0, 6), h2),
+                       _mm256_srli_epi32(cv, 1), a1, q);
+            q = vmix<vquarter>(a1, a2); // ixix
+            best.offer(solver_pick::ixix, vtotal2(w0, w2, a1, q, vmixer(a1, q, 6, 0), h0, vmixer(a1, q, 2, 4), h2),
+                       _mm256_or_si256(cv, _mm256_srli_epi32(cv, 1)), a1, q);
+            const vcolor p = vmix<vbefore>(a1, a2); // xiix
+            best.offer(solver_pick::xiix, vtotal2(w0, w2, p, a2, vmixer(p, a2, 4, 2), h0, vmixer(p, a2, 2, 4), h2),
+                       _mm256_or_si256(_mm256_srli_epi32(cv, 1), _mm256_set1_epi32(static_cast<int>(0xAAAAAAAA))), p, a2);
+#ifdef MC2_SOLVER_COUNTERS
+            best.count(batch.size - at, solver_path::two, outer, solver_path::outer);
+#endif
+
+            vstore(batch.a1, at, vselect(best.b1, a1, outer));
+            vstore(batch.a2, at, vselect(best.b2, x, outer));
+            vstore(batch.cv + at, _mm256_blendv_epi8(best.cv, cv, outer));
+        }
+    }
+}
+
+#endif
+
+namespace {
+    struct solve_impl { solve_fn two, three; const char *name; };
+
+    const solve_impl &helper_select_solver() {
+        static const solve_impl impl =
+#ifdef MC2_SIMD_X86
+            cpu_has_avx2() ? solve_impl{ solve2_avx2, solve3_avx2, "avx2" } :
+#endif
+            solve_impl{ solve2_scalar, solve3_scalar, "scalar" };
+        return impl;
+    }
+}
+
+void fix_blocks(dxt5_chunk *chunks, std::size_t count) {
+    const solve_impl &solve = helper_select_solver();
+    block_batch two{}, three{};
+    for (std::size_t i = 0; i < count; ++i) {
+        dxt5_chunk &chunk = chunks[i];
+        std::array<std::int_fast8_t, 4> dist{};
+        for (std::int_fast8_t k = 0; k < 16; ++k)
+            ++dist[(chunk.cv >> (k * 2)) & 0x3];
+        if (dist[3] != 0) throw mc2_exception("Invalid DXT5 color encoding");
+
+        std::pair<color, color> cs = chunk.getColors();
+        switch ((dist[0] != 0) + (dist[1] != 0) + (dist[2] != 0)) {
+            case 1:
+                fix_block(chunk);
+                break;
+            case 2:
+                // Same normalisation as fix_block, so that w1 == 0
+                if (dist[0] == 0) {
+                    std::swap(cs.first, cs.second);
+                    chunk.cv &= 0xAAAAAAAA;
+                }
+                two.load(chunk, cs.first, cs.second, dist);
+                if (two.size == BatchLanes) solve.two(two), two.store();
+                break;
+            case 3:
+                three.load(chunk, cs.first, cs.second, dist);
+                if (three.size == BatchLanes) solve.three(three), three.store();
+                break;
+            default:
+                throw mc2_exception("Invalid DXT5 color encoding");
+        }
+    }
+    // Lanes past size hold stale values; they are solved and never stored
+    if (two.size != 0) solve.two(two), two.store();
+    if (three.size != 0) solve.three(three), three.store();
+}
+
+const char *fix_blocks_isa() {
+    return helper_select_solver().name;
+}
+
+// The per-block integer division dist_table replaced
+static int helper_division(int num, int den) { return (num + den / 2) / den; }
+
+bool check_dist_divisions(int &w0, int &w1, std::uint64_t &compared) {
+    compared = 0;
+    for (w0 = 0; w0 <= 16; ++w0)
+        for (w1 = 0; w0 + w1 <= 16; ++w1) {
+            const int w2 = 16 - w0 - w1;
+            const dist_consts &c = DistTable(w0, w1);
+            const int K = 18 * w0 * w1 + 2 * w0 * w2 + 8 * w1 * w2, iiix_den = 9 * w0 + w1 + 4 * w2, iixi_den = 9 * w0 + 4 * w2;
+            // Every value a 5 or 6-bit channel, or one clamped to it, can take
+            for (int a1 = 0; a1 < 0x40; ++a1)
+                for (int a2 = 0; a2 < 0x40; ++a2) {
+                    if (K > 0) {
+                        if (c.byK(c.K * a2 + c.w0w2 * (a2 - a1)) != helper_division(K * a2 + w0 * w2 * (a2 - a1), K) ||
+                            c.byK(c.K * a1 + 2 * c.w1w2 * (a2 - a1)) != helper_division(K * a1 + 2 * w1 * w2 * (a2 - a1), K))
+                            return false;
+                        compared += 2;
+                    }
+                    for (int x = 0; x < 0x40; ++x) {
+                        if (iiix_den > 0) {
+                            if (c.iiix_den(c.iiix_a1 * a1 + c.iiix_a2 * a2 - c.iiix_x * x) !=
+                                helper_division(3 * (3 * w0 + w2) * a1 + 3 * (w1 + w2) * a2 - 2 * (w1 + w2) * x, iiix_den))
+                                return false;
+                            ++compared;
+                        }
+                        if (iixi_den > 0) {
+                            if (c.iixi_den(c.iixi_a1 * a1 + c.iixi_a12 * (a1 + a2) - c.iixi_x * x) !=
+                                helper_division(9 * w0 * a1 + 3 * w2 * (a1 + a2) - 2 * w2 * x, iixi_den))
+                                return false;
+                            ++compared;
+                        }
+                    }
+                }
+        }
+    return true;
+}
@@ -1,5 +1,21 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 struct dxt5_chunk;
 
 void fix_block(dxt5_chunk &chunk);
+
+// fix_block on each of count blocks, which need the solver (cs0 < cs1
+// with some 10b index), with the same results. Blocks are solved in
+// batches, several per SIMD instruction where the CPU has AVX2.
+void fix_blocks(dxt5_chunk *chunks, std::size_t count);
+
+// Name of the implementation fix_blocks picked for this CPU
+const char *fix_blocks_isa();
+
+// Compares the precomputed rounded divisions of every weight distribution
+// with the integer division they replaced, over every channel value. False
+// on the first mismatch, with w0 and w1 naming its distribution.
+bool check_dist_divisions(int &w0, int &w1, std::uint64_t &compared);
@@ -1,14 +1,28 @@
 #include "fix_dxt.hpp"
 
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+
+#include "block_cache.hpp"
+#include "dxt_scan.hpp"
 #include "fix_block.hpp"
 #include "mc2_exception.hpp"
+#include "solver_counters.hpp"
+#include "thread_pool.hpp"
 
-template<class T> static void helper_read(const std::vector<char> &texture, T &t) {
+template<class T> static void helper_read(span<const char> texture, T &t) {
     if (texture.size() < sizeof(T)) throw mc2_exception("Texture file not large enough");
     t = *reinterpret_cast<const T*>(texture.data());
 }
 
-template<class T> static void helper_read(const std::vector<char> &texture, size_t &read_offset, T &t) {
+template<class T> static void helper_read(span<const char> texture, size_t &read_offset, T &t) {
     if (texture.size() < read_offset + sizeof(T)) throw mc2_exception("Texture file not large enough");
     t = *reinterpret_cast<const T*>(texture.data() + read_offset);
     read_offset += sizeof(T);
@@ -39,7 +53,32 @@ static bool clean(dxt5_chunk &chunk) {
     return false;
 }
 
-bool needs_fixing(const std::vector<char> &texture) {
+// Only called for blocks with cs0 <= cs1, which always get rewritten
+static void fix_chunk(dxt5_chunk &chunk) {
+    if (chunk.cs0 < chunk.cs1) {
+        if ((chunk.cv & 0xAAAAAAAA) == 0) {
+            // Reframe for less ambiguity
+            std::swap(chunk.cs0, chunk.cs1);
+            chunk.cv ^= 0x55555555;
+            count_path(solver_path::swap);
+        } else {
+            fix_block(chunk);
+            clean(chunk);
+        }
+    } else {
+        // Reframe for less ambiguity
+        if (chunk.cs0 == 0) {
+            chunk.cs0 = 1;
+            chunk.cv = 0x55555555;
+        } else {
+            chunk.cs1 = 0;
+            chunk.cv = 0x00000000;
+        }
+        count_path(solver_path::reframe);
+    }
+}
+
+bool needs_fixing(span<const char> texture) {
     tex_header header;
     helper_read(texture, header);
 
@@ -60,16 +99,14 @@ bool needs_fixing(const std::vector<char> &texture) {
     return false;
 }
 
-bool fix_dxt(std::vector<char> &texture) {
-    size_t read_offset = 0;
-    bool dirty = false;
-    tex_header header;
-    helper_read(texture, read_offset, header);
-    
+bool dxt_layout(span<const char> texture, std::size_t size, tex_header &header, std::size_t &bytes) {
+    helper_read(texture, header);
+
     if (header.type != 26 && header.type != 22) return false;
     if (header.width == 0 || header.height == 0) return false;
 
-    size_t bytes = sizeof(tex_header), bdiv = header.type == 26 ? 1 : 2;
+    size_t bdiv = header.type == 26 ? 1 : 2;
+    bytes = sizeof(tex_header);
     std::uint16_t width = header.width, height = header.height, mmaps;
     for (mmaps = 0; mmaps < header.mmaps; ++mmaps) {
         if (width & 3 || height & 3) {
@@ -83,49 +120,183 @@ bool fix_dxt(std::vector<char> &texture) {
     if (mmaps == 0) throw mc2_exception("Texture contains no valid MipMap Levels");
 
     if (header.mmaps == mmaps) {
-        if (texture.size() != bytes) throw mc2_exception("Texture file an invalid size");
+        if (size != bytes) throw mc2_exception("Texture file an invalid size");
     } else {
-        if (texture.size() < bytes) throw mc2_exception("Texture file is not as large as expected");
+        if (size < bytes) throw mc2_exception("Texture file is not as large as expected");
         header.mmaps = mmaps;
+    }
+    return true;
+}
+
+bool fix_dxt5_blocks(char *data, std::size_t blocks, std::vector<std::uint32_t> &flagged) {
+    // Most blocks already have cs0 > cs1, so only visit the rest
+    flagged.clear();
+    find_ambiguous_blocks(data, blocks, flagged);
+
+    // Blocks the solver has to re-encode are looked up in the block cache,
+    // and the rest of them solved in batches, each distinct one once. The
+    // others are only reframed. The color half (cs0, cs1, cv) is the key.
+    constexpr std::size_t ColorHalf = offsetof(dxt5_chunk, cs0);
+    block_cache *cache = shared_block_cache();
+    thread_local std::vector<std::pair<std::uint64_t, std::uint32_t>> missed; // key, block
+    thread_local std::vector<dxt5_chunk> solve;
+    missed.clear(), solve.clear();
+    std::size_t solver_blocks = 0;
+    for (std::uint32_t i : flagged) {
+        char *block = data + i * sizeof(dxt5_chunk);
+        dxt5_chunk chunk;
+        std::memcpy(&chunk, block, sizeof(chunk));
+        if (chunk.cs0 < chunk.cs1 && (chunk.cv & 0xAAAAAAAA) != 0) {
+            ++solver_blocks;
+            std::uint64_t key, fixed;
+            std::memcpy(&key, block + ColorHalf, sizeof(key));
+            if (cache != nullptr && cache->find(key, fixed)) std::memcpy(block + ColorHalf, &fixed, sizeof(fixed));
+            else missed.emplace_back(key, i);
+            continue;
+        }
+        fix_chunk(chunk);
+        std::memcpy(block, &chunk, sizeof(chunk));
+    }
+    std::sort(missed.begin(), missed.end());
+    for (std::size_t k = 0; k < missed.size(); ++k) {
+        if (k > 0 && missed[k].first == missed[k - 1].first) continue;
+        solve.emplace_back();
+        std::memcpy(&solve.back(), data + missed[k].second * sizeof(dxt5_chunk), sizeof(dxt5_chunk));
+    }
+    fix_blocks(solve.data(), solve.size());
+    for (std::size_t k = 0, s = 0; k < missed.size(); ++s) {
+        clean(solve[s]);
+        const std::uint64_t key = missed[k].first;
+        std::uint64_t fixed;
+        std::memcpy(&fixed, reinterpret_cast<const char *>(&solve[s]) + ColorHalf, sizeof(fixed));
+        if (cache != nullptr) cache->insert(key, fixed);
+        for (; k < missed.size() && missed[k].first == key; ++k)
+            std::memcpy(data + missed[k].second * sizeof(dxt5_chunk) + ColorHalf, &fixed, sizeof(fixed));
+    }
+    if (solver_blocks != 0) {
+        block_cache_count(solver_blocks, solver_blocks - missed.size(), missed.size() - solve.size());
+        count_path(solver_path::cached, solver_blocks - solve.size());
+    }
+    return !flagged.empty();
+}
+
+// Runs of blocks at least this long are split into pieces of PieceBlocks
+constexpr std::size_t SharedBlocks = 16384, PieceBlocks = 4096;
+
+namespace {
+
+// One fix_dxt5_shared call: pieces are claimed in order by the calling
+// thread and by helpers, which hold on to it in case they only start
+// after the call is over
+struct shared_fix {
+    char *data;
+    std::size_t blocks, pieces;
+    std::atomic<std::size_t> next;
+
+    std::mutex lock;
+    std::condition_variable finished;
+    std::size_t done = 0;
+    std::size_t first; // first block changed; blocks if none
+    std::exception_ptr error;
+#ifdef MC2_SOLVER_COUNTERS
+    solver_counters *counts; // the caller's
+#endif
+};
+
+}
+
+static void helper_fix_pieces(shared_fix &fix) {
+    std::vector<std::uint32_t> flagged;
+    for (std::size_t piece; (piece = fix.next.fetch_add(1, std::memory_order_relaxed)) < fix.pieces;) {
+        const std::size_t start = piece * PieceBlocks, blocks = std::min(PieceBlocks, fix.blocks - start);
+        std::size_t first = fix.blocks;
+        std::exception_ptr error;
+#ifdef MC2_SOLVER_COUNTERS
+        // Helpers count towards the caller's texture, not whatever their thread did last
+        solver_counters counts;
+        solver_counters *const outer = Solver_Counts;
+        Solver_Counts = fix.counts != nullptr ? &counts : nullptr;
+#endif
+        try {
+            if (fix_dxt5_blocks(fix.data + start * sizeof(dxt5_chunk), blocks, flagged)) first = start + flagged.front();
+        } catch (...) {
+            error = std::current_exception();
+        }
+#ifdef MC2_SOLVER_COUNTERS
+        Solver_Counts = outer;
+#endif
+        std::lock_guard<std::mutex> guard(fix.lock);
+#ifdef MC2_SOLVER_COUNTERS
+        if (fix.counts != nullptr) *fix.counts += counts;
+#endif
+        fix.first = std::min(fix.first, first);
+        if (error && !fix.error) fix.error = error;
+        if (++fix.done == fix.pieces) fix.finished.notify_all();
+    }
+}
+
+bool fix_dxt5_shared(char *data, std::size_t blocks, thread_pool *helpers, std::size_t *first) {
+    if (helpers == nullptr || helpers->size() < 2 || blocks < SharedBlocks) {
+        thread_local std::vector<std::uint32_t> flagged;
+        if (!fix_dxt5_blocks(data, blocks, flagged)) return false;
+        if (first != nullptr) *first = flagged.front();
+        return true;
+    }
+
+    const std::shared_ptr<shared_fix> fix = std::make_shared<shared_fix>();
+    fix->data = data;
+    fix->blocks = blocks;
+    fix->pieces = (blocks + PieceBlocks - 1) / PieceBlocks;
+    fix->next.store(0, std::memory_order_relaxed);
+    fix->first = blocks;
+#ifdef MC2_SOLVER_COUNTERS
+    fix->counts = Solver_Counts;
+#endif
+    // Queued behind other entries, helpers only get to run once workers
+    // run out of those, which is when one big texture holds up the rest
+    const std::size_t wanted = std::min<std::size_t>(helpers->size() - 1, fix->pieces - 1);
+    for (std::size_t i = 0; i < wanted; ++i) helpers->submit([fix]() { helper_fix_pieces(*fix); });
+    helper_fix_pieces(*fix);
+
+    // Every piece is claimed by now; wait for those still being worked on
+    std::unique_lock<std::mutex> guard(fix->lock);
+    fix->finished.wait(guard, [&fix]() { return fix->done == fix->pieces; });
+    if (fix->error) std::rethrow_exception(fix->error);
+    if (fix->first == blocks) return false;
+    if (first != nullptr) *first = fix->first;
+    return true;
+}
+
+bool fix_dxt(std::vector<char> &texture, std::size_t *first, thread_pool *helpers) {
+    size_t read_offset = 0, bytes;
+    bool dirty = false;
+    tex_header header, stored;
+    if (!dxt_layout(texture, texture.size(), header, bytes)) return false;
+    helper_read(texture, read_offset, stored);
+
+    if (header.mmaps != stored.mmaps) {
         helper_override(texture, read_offset, header);
         texture.resize(bytes);
         dirty = true;
+        if (first != nullptr) *first = 0;
     }
     
     if (header.type == 26) {
+        // The mip levels follow each other, so their blocks are fixed as one run
+        const size_t start = read_offset;
         size_t blocks = (header.width / 4) * (header.height / 4);
         for (std::uint16_t mmap = 0; mmap < header.mmaps; ++mmap) {
-            for (size_t i = 0; i < blocks; ++i) {
-                dxt5_chunk chunk;
-                helper_read(texture, read_offset, chunk);
-
-                if (chunk.cs0 < chunk.cs1) {
-                    if ((chunk.cv & 0xAAAAAAAA) == 0) {
-                        // Reframe for less ambiguity
-                        std::swap(chunk.cs0, chunk.cs1);
-                        chunk.cv ^= 0x55555555;
-                    } else {
-                        fix_block(chunk);
-                        clean(chunk);
-                    }
-                    helper_override(texture, read_offset, chunk);
-                    dirty = true;
-                } else if (chunk.cs0 == chunk.cs1) {
-                    // Reframe for less ambiguity
-                    if (chunk.cs0 == 0) {
-                        chunk.cs0 = 1;
-                        chunk.cv = 0x55555555;
-                    } else {
-                        chunk.cs1 = 0;
-                        chunk.cv = 0x00000000;
-                    }
-                    helper_override(texture, read_offset, chunk);
-                    dirty = true;
-                }
-            }
+            if (texture.size() < read_offset + blocks * sizeof(dxt5_chunk)) throw mc2_exception("Texture file not large enough");
+            read_offset += blocks * sizeof(dxt5_chunk);
             blocks /= 4;
         }
         if (read_offset != bytes) throw mc2_exception("Texture file not large enough");
+
+        std::size_t changed;
+        if (fix_dxt5_shared(texture.data() + start, (bytes - start) / sizeof(dxt5_chunk), helpers, &changed)) {
+            if (first != nullptr && !dirty) *first = start + changed * sizeof(dxt5_chunk);
+            dirty = true;
+        }
     }
 
     return dirty;
@@ -6,7 +6,10 @@
 #include <utility>
 #include <vector>
 
+#include "span.hpp"
+
 struct color;
+class thread_pool;
 
 struct tex_header {
     std::uint16_t width, height, type, mmaps;
@@ -22,5 +25,23 @@ struct dxt5_chunk {
 };
 
 constexpr size_t FixingSize = sizeof(tex_header);
-bool needs_fixing(const std::vector<char> &texture);
-bool fix_dxt(std::vector<char> &texture);
+bool needs_fixing(span<const char> texture);
+// first, if given, is set to the offset of the first byte changed. Idle
+// workers of helpers, if given, take a share of the blocks of big textures.
+bool fix_dxt(std::vector<char> &texture, std::size_t *first = nullptr, thread_pool *helpers = nullptr);
+
+// The layout fix_dxt works from, for a texture of size bytes starting with
+// texture: header with mmaps cut down to the valid levels, and the bytes
+// those take. False for textures fix_dxt leaves alone; throws for the
+// invalid ones it would throw for.
+bool dxt_layout(span<const char> texture, std::size_t size, tex_header &header, std::size_t &bytes);
+
+// Fixes the ambiguous ones of `blocks` consecutive dxt5_chunk at data,
+// using flagged as scratch. True if there were any.
+bool fix_dxt5_blocks(char *data, std::size_t blocks, std::vector<std::uint32_t> &flagged);
+
+// fix_dxt5_blocks on runs of many blocks, split into pieces that idle
+// workers of helpers pick up while this thread works through them too.
+// Small runs, or no helpers, stay on this thread. first, if given, is set
+// to the index of the first block changed. Same bytes either way.
+bool fix_dxt5_shared(char *data, std::size_t blocks, thread_pool *helpers, std::size_t *first = nullptr);
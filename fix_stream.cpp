@@ -0,0 +1,169 @@
+#include "fix_stream.hpp"
+
+#include <cstring>
+
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "dat_stats.hpp"
+#include "dxt_scan.hpp"
+#include "dxt_verify.hpp"
+#include "fix_dxt.hpp"
+#include "mc2_exception.hpp"
+#include "zlib_streams.hpp"
+
+namespace {
+    // The bytes of a texture in order, copied from a stored payload or
+    // inflated as they are asked for
+    class texture_source {
+    public:
+        texture_source(span<const char> payload, const file_info &file) : payload(payload), left(file.decompressLen) {
+            if (file.compressLen > file.decompressLen) throw mc2_exception("Compressed texture larger than decompressed is invalid");
+            if (file.compressLen == file.decompressLen) return;
+            strm = &thread_zlib_streams().inflater();
+            strm->avail_in = static_cast<uInt>(payload.size());
+            strm->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(payload.data()));
+        }
+
+        void read(char *data, std::size_t n) {
+            if (n > left) throw mc2_exception("Texture file not large enough");
+            left -= n;
+            if (strm == nullptr) {
+                std::memcpy(data, payload.data() + used, n);
+                used += n;
+                return;
+            }
+
+            stage_timer timer(stat_stage::inflate);
+            strm->avail_out = static_cast<uInt>(n);
+            strm->next_out = reinterpret_cast<Bytef *>(data);
+            while (strm->avail_out != 0) {
+                if (ended) throw mc2_exception("Decompressed size incorrect");
+                int ret = ::inflate(strm, Z_NO_FLUSH);
+                if (ret == Z_STREAM_END) ended = true;
+                else if (ret != Z_OK) throw zlib_exception(ret, strm->msg);
+            }
+            stat_add(&dat_stats::bytesInflated, n);
+        }
+
+        // Reads past whatever wasn't kept and checks that the stream ends with the texture
+        void finish(std::vector<char> &scratch) {
+            while (left > 0) read(scratch.data(), std::min(left, scratch.size()));
+            if (strm == nullptr || ended) {
+                if (strm != nullptr && strm->avail_in != 0) throw mc2_exception("Compressed size incorrect");
+                return;
+            }
+            char extra;
+            strm->avail_out = 1;
+            strm->next_out = reinterpret_cast<Bytef *>(&extra);
+            int ret = ::inflate(strm, Z_FINISH);
+            if (strm->avail_out == 0) throw mc2_exception("Decompressed size incorrect");
+            if (ret != Z_STREAM_END) throw zlib_exception(ret, strm->msg);
+            if (strm->avail_in != 0) throw mc2_exception("Compressed size incorrect");
+        }
+
+    private:
+        span<const char> payload;
+        std::size_t left, used = 0;
+        z_stream *strm = nullptr;
+        bool ended = false;
+    };
+
+    // Deflates into out, giving up once the stream would be longer than limit
+    class deflate_sink {
+    public:
+        deflate_sink(int level, std::vector<char> &out, std::size_t limit)
+            : strm(thread_zlib_streams().deflater(level)), out(out), limit(limit) {
+            out.clear();
+            strm.avail_out = 0; // a reset stream still points into the last texture's output
+        }
+
+        // False if the stream has outgrown limit
+        bool write(const char *data, std::size_t n, int flush) {
+            stage_timer timer(stat_stage::deflate);
+            stat_add(&dat_stats::bytesDeflated, n);
+            strm.avail_in = static_cast<uInt>(n);
+            strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+            for (;;) {
+                if (strm.avail_out == 0) {
+                    const std::size_t used = out.size();
+                    if (used >= limit) return false;
+                    out.resize(std::min(limit, std::max<std::size_t>(2 * used, 64 << 10)));
+                    strm.avail_out = static_cast<uInt>(out.size() - used);
+                    strm.next_out = reinterpret_cast<Bytef *>(out.data() + used);
+                }
+                int ret = ::deflate(&strm, flush);
+                if (ret == Z_STREAM_END) {
+                    out.resize(out.size() - strm.avail_out);
+                    return true;
+                }
+                if (ret != Z_OK) throw zlib_exception(ret, strm.msg);
+                if (flush == Z_NO_FLUSH && strm.avail_in == 0) return true;
+            }
+        }
+
+    private:
+        z_stream &strm;
+        std::vector<char> &out;
+        const std::size_t limit;
+    };
+}
+
+stream_fix fix_dxt_streaming(span<const char> payload, file_info &file, int level, std::size_t window,
+                             std::vector<char> &buffer, std::vector<char> &out, thread_pool *helpers,
+                             texture_error *verify) {
+    // Whole blocks per window; every mip level is a multiple of them, so
+    // a window never splits one
+    window = std::max(window & ~(sizeof(dxt5_chunk) - 1), sizeof(dxt5_chunk));
+    buffer.resize(window);
+    std::vector<std::uint32_t> flagged;
+    std::vector<char> original; // of the window, for verify
+
+    tex_header header, stored;
+    std::size_t bytes;
+    {
+        // First pass only looks, so a good texture costs one inflate as before
+        texture_source in(payload, file);
+        in.read(reinterpret_cast<char *>(&stored), sizeof(stored));
+        bool dirty = false;
+        if (dxt_layout({ reinterpret_cast<const char *>(&stored), sizeof(stored) }, file.decompressLen, header, bytes)) {
+            dirty = header.mmaps != stored.mmaps;
+            for (std::size_t left = bytes - sizeof(tex_header), n; left > 0 && !dirty && header.type == 26; left -= n) {
+                n = std::min(left, window);
+                in.read(buffer.data(), n);
+                stage_timer timer(stat_stage::fix);
+                flagged.clear();
+                find_ambiguous_blocks(buffer.data(), n / sizeof(dxt5_chunk), flagged);
+                dirty = !flagged.empty();
+            }
+        }
+        if (!dirty) {
+            in.finish(buffer);
+            return stream_fix::unchanged;
+        }
+    }
+
+    texture_source in(payload, file);
+    deflate_sink sink(level, out, bytes - 1);
+    in.read(reinterpret_cast<char *>(&stored), sizeof(stored));
+    bool fits = sink.write(reinterpret_cast<const char *>(&header), sizeof(header), Z_NO_FLUSH);
+    for (std::size_t left = bytes - sizeof(tex_header), n; left > 0 && fits; left -= n) {
+        n = std::min(left, window);
+        in.read(buffer.data(), n);
+        if (header.type == 26) {
+            stage_timer timer(stat_stage::fix);
+            if (verify != nullptr) original.assign(buffer.data(), buffer.data() + n);
+            fix_dxt5_shared(buffer.data(), n / sizeof(dxt5_chunk), helpers);
+            if (verify != nullptr) verify->add(original.data(), buffer.data(), n / sizeof(dxt5_chunk), true);
+        } else if (verify != nullptr) verify->add(buffer.data(), buffer.data(), n / 8, false);
+        fits = sink.write(buffer.data(), n, Z_NO_FLUSH);
+    }
+    if (fits) fits = sink.write(nullptr, 0, Z_FINISH);
+    if (!fits) return stream_fix::incompressible;
+    in.finish(buffer);
+
+    file.decompressLen = static_cast<std::uint32_t>(bytes);
+    file.compressLen = static_cast<std::uint32_t>(out.size());
+    return stream_fix::patched;
+}
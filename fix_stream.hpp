@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+#include "dat_format.hpp"
+#include "span.hpp"
+
+class thread_pool;
+struct texture_error;
+
+enum class stream_fix {
+    unchanged,     // nothing to fix, file and out untouched
+    patched,       // out holds the new compressed texture, file describes it
+    incompressible // fixed, but deflate didn't make it smaller; redo it in memory
+};
+
+// inflate + fix_dxt + deflate at level, a window of window bytes at a time,
+// so memory doesn't grow with the texture beyond the compressed output.
+// payload is stored or deflated as file says. Always uses zlib, and gives
+// the same bytes as the in-memory path does with it. Idle workers of
+// helpers, if given, take a share of the blocks of each window. verify, if
+// given, gets the error of the fix added.
+stream_fix fix_dxt_streaming(span<const char> payload, file_info &file, int level, std::size_t window,
+                             std::vector<char> &buffer, std::vector<char> &out, thread_pool *helpers = nullptr,
+                             texture_error *verify = nullptr);
@@ -0,0 +1,177 @@
+#include "io_ring.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <ios>
+#include <vector>
+
+#ifdef MC2_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static int helper_setup(unsigned entries, io_uring_params &params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+}
+
+static int helper_enter(int fd, unsigned submit, unsigned wait) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0));
+}
+
+static int helper_register(int fd, unsigned opcode, const void *arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+template<class T> static T *helper_at(void *base, unsigned offset) {
+    return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+bool io_ring::available() {
+    static const bool supported = []() {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        const int fd = helper_setup(2, params);
+        if (fd < 0) return false; // ENOSYS, or disabled by sysctl / seccomp
+        // Writes, fixed writes and read-ahead advice (Linux 5.6)
+        std::vector<char> storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(storage.data());
+        bool ok = helper_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+        for (unsigned op : { IORING_OP_WRITE, IORING_OP_WRITE_FIXED, IORING_OP_FADVISE })
+            ok = ok && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+        close(fd);
+        return ok;
+    }();
+    return supported;
+}
+
+io_ring::io_ring(unsigned entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    fd = helper_setup(entries, params);
+    if (fd < 0) throw std::ios_base::failure("Unable to set up io_uring");
+    sq_entries = params.sq_entries;
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    sq_ring = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) sq_ring = nullptr;
+    cq_ring = single ? sq_ring : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) cq_ring = nullptr;
+    sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) sqes = nullptr;
+    if (sq_ring == nullptr || cq_ring == nullptr || sqes == nullptr) {
+        release();
+        throw std::ios_base::failure("Unable to map io_uring");
+    }
+
+    sq_tail = helper_at<unsigned>(sq_ring, params.sq_off.tail);
+    sq_mask = helper_at<unsigned>(sq_ring, params.sq_off.ring_mask);
+    sq_array = helper_at<unsigned>(sq_ring, params.sq_off.array);
+    cq_head = helper_at<unsigned>(cq_ring, params.cq_off.head);
+    cq_tail = helper_at<unsigned>(cq_ring, params.cq_off.tail);
+    cq_mask = helper_at<unsigned>(cq_ring, params.cq_off.ring_mask);
+    cqes = helper_at<void>(cq_ring, params.cq_off.cqes);
+}
+
+io_ring::~io_ring() {
+    release();
+}
+
+void io_ring::release() {
+    if (sqes != nullptr) munmap(sqes, sqes_size);
+    if (cq_ring != nullptr && cq_ring != sq_ring) munmap(cq_ring, cq_size);
+    if (sq_ring != nullptr) munmap(sq_ring, sq_size);
+    sqes = cq_ring = sq_ring = nullptr;
+    if (fd >= 0) close(fd);
+    fd = -1;
+}
+
+bool io_ring::register_buffers(span<const span<char>> buffers) {
+    std::vector<iovec> vecs;
+    for (const span<char> &buffer : buffers) vecs.push_back({ buffer.data(), buffer.size() });
+    return helper_register(fd, IORING_REGISTER_BUFFERS, vecs.data(), static_cast<unsigned>(vecs.size())) == 0;
+}
+
+void *io_ring::next_entry() {
+    // Only this thread moves the tail, the kernel the head
+    if (queued == sq_entries) submit();
+    const unsigned tail = *sq_tail + queued;
+    const unsigned index = tail & *sq_mask;
+    sq_array[index] = index;
+    ++queued;
+    io_uring_sqe *sqe = static_cast<io_uring_sqe *>(sqes) + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void io_ring::write(int file, const char *data, std::uint32_t length, std::uint64_t offset, std::uint64_t tag, int buffer) {
+    io_uring_sqe *sqe = static_cast<io_uring_sqe *>(next_entry());
+    sqe->opcode = buffer >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = file;
+    sqe->addr = reinterpret_cast<std::uint64_t>(data);
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->buf_index = static_cast<std::uint16_t>(buffer >= 0 ? buffer : 0);
+    sqe->user_data = tag;
+}
+
+void io_ring::will_need(int file, std::uint64_t offset, std::uint32_t length, std::uint64_t tag) {
+    io_uring_sqe *sqe = static_cast<io_uring_sqe *>(next_entry());
+    sqe->opcode = IORING_OP_FADVISE;
+    sqe->fd = file;
+    sqe->off = offset;
+    sqe->len = length;
+    sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+    sqe->user_data = tag;
+}
+
+void io_ring::submit(unsigned wait) {
+    __atomic_store_n(sq_tail, *sq_tail + queued, __ATOMIC_RELEASE);
+    unsigned submitting = queued;
+    queued = 0;
+    for (;;) {
+        const int ret = helper_enter(fd, submitting, wait);
+        if (ret >= 0) {
+            // All of them go in unless the ring is short of memory; retry the rest
+            submitting -= static_cast<unsigned>(ret);
+            if (submitting == 0) return;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            throw std::ios_base::failure("Unable to submit to io_uring");
+        }
+    }
+}
+
+bool io_ring::reap(completion &c) {
+    const unsigned head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return false;
+    const io_uring_cqe &cqe = static_cast<const io_uring_cqe *>(cqes)[head & *cq_mask];
+    c.tag = cqe.user_data;
+    c.result = cqe.res;
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#else
+
+bool io_ring::available() { return false; }
+
+io_ring::io_ring(unsigned) { throw std::ios_base::failure("Built without io_uring"); }
+io_ring::~io_ring() { }
+void io_ring::release() { }
+
+bool io_ring::register_buffers(span<const span<char>>) { return false; }
+void *io_ring::next_entry() { return nullptr; }
+void io_ring::write(int, const char *, std::uint32_t, std::uint64_t, std::uint64_t, int) { }
+void io_ring::will_need(int, std::uint64_t, std::uint32_t, std::uint64_t) { }
+void io_ring::submit(unsigned) { }
+bool io_ring::reap(completion &) { return false; }
+
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "span.hpp"
+
+// A small io_uring over the raw system calls (there is no liburing
+// dependency), for file_writer's queued writes and the read-ahead of the
+// mapped archive. Only built where the kernel headers have io_uring;
+// available() also probes the running kernel for the opcodes used here.
+class io_ring {
+public:
+    struct completion {
+        std::uint64_t tag;
+        std::int32_t result; // bytes, or -errno
+    };
+
+    static bool available();
+
+    // Throws std::ios_base::failure if the ring can't be set up
+    explicit io_ring(unsigned entries);
+    ~io_ring();
+
+    io_ring(const io_ring &) = delete;
+    io_ring &operator=(const io_ring &) = delete;
+
+    unsigned entries() const { return sq_entries; }
+
+    // Registers buffers for write with a buffer index. False if the kernel
+    // refuses, e.g. over RLIMIT_MEMLOCK; writes then go unregistered.
+    bool register_buffers(span<const span<char>> buffers);
+
+    // Queued until the next submit. buffer is the registered buffer data
+    // lies in, or -1.
+    void write(int fd, const char *data, std::uint32_t length, std::uint64_t offset, std::uint64_t tag, int buffer = -1);
+    void will_need(int fd, std::uint64_t offset, std::uint32_t length, std::uint64_t tag);
+
+    // Submits everything queued and waits until at least wait completions are ready
+    void submit(unsigned wait = 0);
+    // Takes the next ready completion, if any
+    bool reap(completion &c);
+
+private:
+    void *next_entry();
+    void release();
+
+    int fd = -1;
+    unsigned sq_entries = 0, queued = 0;
+    void *sq_ring = nullptr, *cq_ring = nullptr, *sqes = nullptr;
+    std::size_t sq_size = 0, cq_size = 0, sqes_size = 0;
+    unsigned *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+    void *cqes = nullptr;
+};
@@ -1,37 +1,324 @@
+#include "block_cache.hpp"
+#include "codec.hpp"
+#include "dat_batch.hpp"
+#include "dat_extract.hpp"
+#include "dat_manifest.hpp"
+#include "dat_map.hpp"
+#include "dat_pack.hpp"
 #include "dat_proc.hpp"
+#include "dat_reader.hpp"
+#include "dat_stats.hpp"
+#include "dat_writer.hpp"
+#include "deflate_search.hpp"
+#include "io_ring.hpp"
+#include "name_table.hpp"
+#include "solver_counters.hpp"
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 #include <exception>
-#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
+
+// Patches one archive next to a backup, or in place with an undo journal.
+// With a manifest path, entries it recorded as checked are skipped and it
+// is rewritten for the new archive.
+static void helper_patch(const std::string &dat_name, const std::string &bak_name, bool in_place,
+                         const std::string *manifest_name) {
+    dat_manifest manifest;
+    if (manifest_name != nullptr) manifest.load(*manifest_name);
+    if (in_place) {
+        if (!Quiet_Output) std::cout << "Checking for textures that may require patching:" << std::endl;
+        process_textures_in_place(dat_name, bak_name, manifest_name != nullptr ? &manifest : nullptr);
+    } else {
+        if (!Quiet_Output) std::cout << "Backing up original archive." << std::endl;
+        int ret = std::rename(dat_name.c_str(), bak_name.c_str());
+        if (ret != 0) throw std::ios_base::failure("Unable to move file. Does the backup file already exist?");
+
+        dat_map in(bak_name);
+        file_writer out(dat_name, &in);
+        if (!Quiet_Output) std::cout << "Checking for textures that may require patching:" << std::endl;
+        process_textures(in, out, manifest_name != nullptr ? &manifest : nullptr);
+    }
+    if (manifest_name != nullptr) manifest.save(*manifest_name);
+}
+
+// How often the block cache saved solving a block, for the run summary
+static void helper_cache_summary() {
+    const block_cache_counts counts = block_cache_totals();
+    if (counts.blocks == 0) return;
+    std::cout << "Block cache: " << counts.hits << " of " << counts.blocks << " solved blocks found ("
+              << (100 * counts.hits + counts.blocks / 2) / counts.blocks << "%), " << counts.duplicates
+              << " more repeated within a texture" << std::endl;
+}
+
+// Every archive of a batch gets its backup (or journal) and manifest beside it
+static int helper_batch(const std::vector<std::string> &args, bool in_place, bool undo, bool use_manifest) {
+    std::vector<batch_archive> archives;
+    for (const std::string &path : expand_archive_args(args)) {
+        archives.emplace_back();
+        archives.back().path = path;
+    }
+    if (archives.empty()) {
+        std::cerr << "ERROR - No archives found" << std::endl;
+        return 1;
+    }
+
+    // Entry lines of archives running side by side would interleave
+    const bool quiet = Quiet_Output;
+    Quiet_Output = true;
+    std::size_t failed = 0;
+    archive_tally total;
+    process_batch(archives, [=](const std::string &path) {
+        const std::string bak_name = path + (in_place || undo ? ".journal" : ".BAK"), manifest_name = path + ".manifest";
+        if (undo) undo_in_place(path, bak_name);
+        else helper_patch(path, bak_name, in_place, use_manifest ? &manifest_name : nullptr);
+    }, [&](const batch_archive &archive) {
+        total.skipped += archive.tally.skipped, total.good += archive.tally.good, total.patched += archive.tally.patched;
+        total.unchanged += archive.tally.unchanged;
+        if (!archive.ok) {
+            ++failed;
+            std::cerr << "ERROR - " << archive.path << ": " << archive.error << std::endl;
+        } else if (!quiet) {
+            std::cout << archive.path << " - " << archive.tally.patched << " patched, " << archive.tally.good << " good";
+            if (archive.tally.unchanged != 0) std::cout << ", " << archive.tally.unchanged << " unchanged";
+            std::cout << std::endl;
+        }
+    });
+    Quiet_Output = quiet;
+
+    if (!quiet || failed != 0) {
+        std::cout << archives.size() << " archives: " << archives.size() - failed << " done, " << failed << " failed; "
+                  << total.patched << " textures patched, " << total.good << " good, ";
+        if (total.unchanged != 0) std::cout << total.unchanged << " unchanged since the last run, ";
+        std::cout << total.skipped << " other entries" << std::endl;
+    }
+    if (failed != 0) {
+        std::cout << "Failed:" << std::endl;
+        for (const batch_archive &archive : archives)
+            if (!archive.ok) std::cout << "  " << archive.path << std::endl;
+    }
+    return failed != 0 ? 1 : 0;
+}
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        std::cout << "Usage: " << (argc > 0 ? argv[0] : "<executable>") << " <dat file> [backup path] [-fN (compression level)]" << std::endl;
+    std::string dat_name, bak_name;
+    std::string manifest_name;
+    bool in_place = false, undo = false, use_manifest = false, list = false, sequential = false;
+    bool stats = false, stats_json = false, batch = false;
+    std::vector<std::string> paths;
+    const bool extract = argc > 1 && std::strcmp(argv[1], "extract") == 0;
+    const bool pack = argc > 1 && std::strcmp(argv[1], "pack") == 0;
+    bool plain_names = false;
+    std::vector<std::string> extract_names;
+    for (int i = extract || pack ? 2 : 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (arg[0] == '-' && arg[1] != '\0') {
+            if (arg[1] == 'f' && arg[2] >= '0' && arg[2] <= '9')
+                Zlib_Compression_Level = arg[2] - '0';
+            else if (arg[1] == 'j' && arg[2] >= '0' && arg[2] <= '9')
+                Worker_Threads = std::atoi(arg + 2);
+            else if (std::strcmp(arg, "--in-place") == 0) in_place = true;
+            else if (std::strcmp(arg, "--undo") == 0) undo = true;
+            else if (std::strcmp(arg, "--list") == 0) list = true;
+            else if (std::strcmp(arg, "--sequential") == 0) sequential = true;
+            else if (std::strcmp(arg, "--quiet") == 0) Quiet_Output = true;
+            else if (std::strcmp(arg, "--stats") == 0) stats = true;
+            else if (std::strcmp(arg, "--stats=json") == 0) stats = stats_json = true;
+            else if (std::strncmp(arg, "--codec=", 8) == 0) {
+                if (!parse_codec_backend(arg + 8, Codec_Backend) || !codec_available(Codec_Backend)) {
+                    std::cerr << "ERROR - Compression backend " << (arg + 8) << " is not available" << std::endl;
+                    return 1;
+                }
+            }
+            else if (std::strcmp(arg, "--optimize") == 0) Optimize_Compression = true;
+            else if (std::strncmp(arg, "--optimize=", 11) == 0) {
+                Optimize_Compression = true;
+                Exhaustive_Budget = static_cast<unsigned>(std::atoi(arg + 11));
+                if (!exhaustive_available()) std::cerr << "WARNING - Built without zopfli, no exhaustive pass" << std::endl;
+            }
+            else if ((std::strcmp(arg, "--only") == 0 || std::strcmp(arg, "--exclude") == 0) && i + 1 < argc) {
+                if (arg[2] == 'o') Name_Filter.only(argv[++i]);
+                else Name_Filter.exclude(argv[++i]);
+            }
+            else if (std::strcmp(arg, "--splice") == 0) Splice_Deflate = true;
+            else if (std::strcmp(arg, "--dedup") == 0) Dedup_Entries = true;
+            else if (std::strcmp(arg, "--solver-stats") == 0) {
+                Solver_Stats = solver_counters_available();
+                if (!Solver_Stats) std::cerr << "WARNING - Built without MC2_SOLVER_COUNTERS, no solver counts" << std::endl;
+            }
+            else if (std::strcmp(arg, "--verify") == 0) Verify_Textures = true;
+            else if (std::strcmp(arg, "--io=sync") == 0) Async_IO = false;
+            else if (std::strcmp(arg, "--io=uring") == 0) {
+                Async_IO = io_ring::available();
+                if (!Async_IO) std::cerr << "WARNING - io_uring is not available, using blocking I/O" << std::endl;
+            }
+            else if (std::strncmp(arg, "--block-cache=", 14) == 0) {
+                char *end;
+                const long mib = std::strtol(arg + 14, &end, 10);
+                if (end == arg + 14 || *end != '\0' || mib < 0) {
+                    std::cerr << "ERROR - --block-cache takes a size in MiB, 0 to turn it off" << std::endl;
+                    return 1;
+                }
+                Block_Cache_Bytes = static_cast<std::size_t>(mib) << 20;
+            }
+            else if (std::strncmp(arg, "--window=", 9) == 0) Texture_Window = static_cast<std::size_t>(std::atoi(arg + 9)) << 10;
+            else if (std::strcmp(arg, "--batch") == 0) batch = true;
+            else if (std::strcmp(arg, "--plain-names") == 0) plain_names = true;
+            else if (std::strcmp(arg, "--manifest") == 0) use_manifest = true;
+            else if (std::strncmp(arg, "--manifest=", 11) == 0) use_manifest = true, manifest_name = arg + 11;
+        } else if (dat_name.empty()) dat_name = arg;
+        else if (bak_name.empty()) bak_name = arg;
+        else if (extract) extract_names.push_back(arg);
+        if (!(arg[0] == '-' && arg[1] != '\0')) paths.push_back(arg);
+    }
+    // More than an archive and its backup path, a directory or a list file
+    if (!extract && !pack) {
+        batch = batch || paths.size() > 2;
+        for (const std::string &path : paths) batch = batch || names_archives(path);
+    }
+
+    if (dat_name.empty() || ((extract || pack) && bak_name.empty())) {
+        std::cout << "Usage: " << (argc > 0 ? argv[0] : "<executable>") << " <dat file> [backup path] [-fN (compression level)] [-jN (worker threads)]" << std::endl;
+        std::cout << "       " << (argc > 0 ? argv[0] : "<executable>") << " <dat file> [journal path] --in-place | --undo" << std::endl;
+        std::cout << "       " << (argc > 0 ? argv[0] : "<executable>") << " - <output dat file> (reads the archive from stdin)" << std::endl;
+        std::cout << "       " << (argc > 0 ? argv[0] : "<executable>") << " <dat file> --list" << std::endl;
+        std::cout << "       " << (argc > 0 ? argv[0] : "<executable>") << " [--batch] <dat file | directory | @listfile>... [--in-place | --undo]" << std::endl;
+        std::cout << "       " << (argc > 0 ? argv[0] : "<executable>") << " extract <dat file> <output dir> [name or glob]..." << std::endl;
+        std::cout << "       " << (argc > 0 ? argv[0] : "<executable>") << " pack <input dir> <dat file> [--plain-names]" << std::endl;
+        std::cout << "  extract without names writes every entry and an index (.mc2dat) from which pack" << std::endl;
+        std::cout << "          builds the same archive again; pack without one takes every file in the directory" << std::endl;
+        std::cout << "  --plain-names gives a new archive a plain name table instead of a Base64 one" << std::endl;
+        std::cout << "  --batch patches every archive given (directories are searched for *.dat), sharing" << std::endl;
+        std::cout << "          the workers between them; implied by more than two paths, a directory or @listfile" << std::endl;
+        std::cout << "  --sequential reads the archive front to back in one pass, as it does from stdin" << std::endl;
+        std::cout << "  --only <glob>, --exclude <glob> limit which textures are checked (repeatable; * also matches /)" << std::endl;
+        std::cout << "  --manifest[=path] skips textures checked by a previous run (default: <dat file>.manifest)" << std::endl;
+        std::cout << "  --codec=zlib|libdeflate|zlib-ng selects the deflate library (default: zlib)" << std::endl;
+        std::cout << "  --optimize[=ms] keeps the smallest of several deflate settings for patched textures," << std::endl;
+        std::cout << "                  with an exhaustive pass of up to ms per texture (zopfli builds);" << std::endl;
+        std::cout << "                  how far that pass gets depends on timing, so its output can vary" << std::endl;
+        std::cout << "  --splice only deflates patched textures again from the first changed block," << std::endl;
+        std::cout << "           keeping the original stream before it (whole textures in memory)" << std::endl;
+        std::cout << "  --dedup writes identical payloads once, with the later entries pointing at the first" << std::endl;
+        std::cout << "          copy, and fixes identical textures only once" << std::endl;
+        std::cout << "  --window=KiB fixes textures over 4 windows a window at a time to bound memory" << std::endl;
+        std::cout << "               (default: 256, 0 keeps whole textures in memory)" << std::endl;
+        std::cout << "  --block-cache=MiB remembers fixed color blocks for identical ones in any texture" << std::endl;
+        std::cout << "                    (default: 16, 0 solves every block)" << std::endl;
+        std::cout << "  --io=sync|uring queues archive writes and read-ahead on an io_uring (Linux 5.6+)" << std::endl;
+        std::cout << "                  where available (default: sync)" << std::endl;
+        std::cout << "  --solver-stats counts the DXT5 fix's paths, candidate picks and error per texture" << std::endl;
+        std::cout << "                 and per archive (builds with MC2_SOLVER_COUNTERS)" << std::endl;
+        std::cout << "  --verify decodes patched textures before and after the fix and reports the largest" << std::endl;
+        std::cout << "           channel error, RMSE and PSNR per texture and per archive" << std::endl;
+        std::cout << "  --stats[=json] reports time and bytes per stage at the end" << std::endl;
+        std::cout << "  --quiet only prints errors (and --stats)" << std::endl;
+        return 0;
+    }
+    if (extract) {
+        try {
+            dat_map in(dat_name);
+            const std::size_t written = extract_names.empty() ? extract_archive(in, bak_name)
+                                                              : extract_entries(in, bak_name, extract_names);
+            if (!Quiet_Output) std::cout << "Extracted " << written << " entries" << std::endl;
+        } catch (std::exception &e) {
+            std::cerr << "ERROR - " << e.what() << std::endl;
+            throw;
+        }
+        return 0;
+    }
+    if (pack) {
+        try {
+            const std::size_t written = pack_archive(dat_name, bak_name, plain_names);
+            if (!Quiet_Output) std::cout << "Packed " << written << " entries" << std::endl;
+        } catch (std::exception &e) {
+            std::cerr << "ERROR - " << e.what() << std::endl;
+            throw;
+        }
         return 0;
     }
-    std::string dat_name = argv[1];
-    std::string bak_name = argc < 3 || argv[2][0] == '-' ? dat_name + ".BAK" : argv[2];
+    if (Dedup_Entries && (in_place || undo)) {
+        std::cerr << "ERROR - --dedup rewrites the archive, so it can't be combined with --in-place or --undo" << std::endl;
+        return 1;
+    }
+    if (batch) {
+        if (sequential || list || dat_name == "-" || manifest_name != "") {
+            std::cerr << "ERROR - Batches can't be combined with --sequential, --list, stdin or --manifest=path" << std::endl;
+            return 1;
+        }
+        dat_stats counters;
+        if (stats) Run_Stats = &counters;
+        counters.start();
+        const int ret = helper_batch(paths, in_place, undo, use_manifest);
+        counters.finish();
+        if (stats) counters.print(std::cout, stats_json);
+        if (stats || !Quiet_Output) helper_cache_summary();
+        return ret;
+    }
+    if (dat_name == "-") sequential = true;
+    if (sequential && (in_place || undo || list || use_manifest)) {
+        std::cerr << "ERROR - Sequential input can't be combined with --in-place, --undo, --list or --manifest" << std::endl;
+        return 1;
+    }
+    if (dat_name == "-" && bak_name.empty()) {
+        std::cerr << "ERROR - Reading from stdin needs an output path" << std::endl;
+        return 1;
+    }
+    if (manifest_name.empty()) manifest_name = dat_name + ".manifest";
+    if (bak_name.empty()) bak_name = dat_name + (in_place || undo ? ".journal" : ".BAK");
 
-    if (argv[argc - 1][0] == '-' && argv[argc - 1][1] == 'f' &&
-        argv[argc - 1][2] >= '0' && argv[argc - 1][2] <= '9')
-        Zlib_Compression_Level = argv[argc - 1][2] - '0';
+    dat_stats counters;
+    if (stats) Run_Stats = &counters;
 
     try {
-        std::cout << "Backing up original archive." << std::endl;
-        int ret = std::rename(dat_name.c_str(), bak_name.c_str());
-        if (ret != 0) throw std::ios_base::failure("Unable to move file. Does the backup file already exist?");
+        if (list) {
+            dat_manifest manifest;
+            dat_map in(dat_name);
+            if (manifest.load(manifest_name) && manifest.describes(in.size(), in.files())) {
+                for (const manifest_entry &entry : manifest.entries) std::cout << entry.name << '\n';
+            } else {
+                for (const std::string &name : read_names(in)) std::cout << name << '\n';
+            }
+            std::cout << std::flush;
+            return 0;
+        }
+
+        if (undo) {
+            if (!Quiet_Output) std::cout << "Restoring archive from undo journal." << std::endl;
+            undo_in_place(dat_name, bak_name);
+            if (!Quiet_Output) std::cout << "Finished!" << std::endl;
+            return 0;
+        }
+        if (sequential) {
+            std::string in_name = bak_name;
+            if (dat_name != "-") {
+                if (!Quiet_Output) std::cout << "Backing up original archive." << std::endl;
+                int ret = std::rename(dat_name.c_str(), bak_name.c_str());
+                if (ret != 0) throw std::ios_base::failure("Unable to move file. Does the backup file already exist?");
+            } else in_name = dat_name;
 
-        std::ifstream in(bak_name, std::ios_base::in | std::ios_base::binary);
-        std::ofstream out(dat_name, std::ios_base::out | std::ios_base::binary);
-        std::cout << "Checking for textures that may require patching:" << std::endl;
-        process_textures(in, out);
+            forward_reader in(in_name);
+            file_writer out(dat_name != "-" ? dat_name : bak_name);
+            if (!Quiet_Output) std::cout << "Checking for textures that may require patching:" << std::endl;
+            counters.start();
+            process_textures_sequential(in, out);
+            counters.finish();
+        } else {
+            counters.start();
+            helper_patch(dat_name, bak_name, in_place, use_manifest ? &manifest_name : nullptr);
+            counters.finish();
+        }
     } catch (std::exception &e) {
         std::cerr << "ERROR - " << e.what() << std::endl;
         throw;
     }
 
-    std::cout << "Finished!" << std::endl;
+    if (stats) counters.print(std::cout, stats_json);
+    if (stats || !Quiet_Output) helper_cache_summary();
+    if (!Quiet_Output) std::cout << "Finished!" << std::endl;
     return 0;
 }
@@ -1,4 +1,8 @@
+#pragma once
+
 #include <exception>
+#include <sstream>
+#include <string>
 
 class mc2_exception : public std::exception {
 public:
@@ -8,3 +12,16 @@ public:
 private:
     const char *msg;
 };
+
+class zlib_exception : public std::exception {
+public:
+    zlib_exception(int err, const char *what) {
+        std::ostringstream out;
+        out << "Zlib error " << err << ": " << (what != nullptr ? what : "(no message)");
+        msg = out.str();
+    }
+    virtual const char *what() const noexcept override { return msg.c_str(); }
+
+private:
+    std::string msg;
+};
@@ -0,0 +1,157 @@
+#include "mc2tex.hpp"
+
+#include <cstring>
+
+#include <exception>
+#include <ios>
+#include <new>
+
+#include "dat_proc.hpp"
+#include "entry_job.hpp"
+#include "mc2_exception.hpp"
+
+const char *mc2_status_name(mc2_status status) {
+    switch (status) {
+        case mc2_status::ok: return "ok";
+        case mc2_status::stopped: return "stopped";
+        case mc2_status::io_error: return "I/O error";
+        case mc2_status::bad_archive: return "invalid archive";
+        case mc2_status::bad_entry: return "invalid entry";
+        case mc2_status::codec_error: return "corrupt deflate stream";
+        case mc2_status::out_of_memory: return "out of memory";
+        case mc2_status::failed: return "failed";
+    }
+    return "unknown";
+}
+
+template<class T> static void helper_write_at(dat_writer &out, const std::uint64_t pos, span<const T> v) {
+    out.seek(pos);
+    out.write({ reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T) });
+}
+
+// Runs f, turning whatever it throws into a status and a message
+template<class F> mc2_status dat_archive::guard(const dat_entry *entry, F f) {
+    mc2_status status;
+    try {
+        return f();
+    } catch (const std::ios_base::failure &e) {
+        status = mc2_status::io_error, message = e.what();
+    } catch (const zlib_exception &e) {
+        status = mc2_status::codec_error, message = e.what();
+    } catch (const mc2_exception &e) {
+        status = entry != nullptr ? mc2_status::bad_entry : mc2_status::bad_archive, message = e.what();
+    } catch (const std::bad_alloc &) {
+        status = mc2_status::out_of_memory, message = "Out of memory";
+    } catch (const std::exception &e) {
+        status = mc2_status::failed, message = e.what();
+    }
+    if (entry != nullptr) message = entry->name + ": " + message;
+    return status;
+}
+
+mc2_status dat_archive::open(dat_reader &reader) {
+    in = &reader;
+    entries.clear();
+    message.clear();
+    return guard(nullptr, [&]() {
+        const std::uint64_t size = reader.size();
+        if (size < 2048) throw mc2_exception("Archive smaller than its header");
+        std::memcpy(&head, reader.read(0, sizeof(head), scratch).data(), sizeof(head));
+        if (head.magic != MAGIC_DAVE && head.magic != MAGIC_Dave) throw mc2_exception("Unknown DAT file format. Maybe a ZIP file?");
+        if (2048 + static_cast<std::uint64_t>(head.numFiles) * sizeof(file_info) > size ||
+            2048 + static_cast<std::uint64_t>(head.metaLen) + head.nameLen > size)
+            throw mc2_exception("Archive is truncated");
+
+        std::vector<file_info> files(head.numFiles);
+        std::memcpy(files.data(), reader.read(2048, files.size() * sizeof(file_info), scratch).data(), files.size() * sizeof(file_info));
+        const span<const char> table = reader.read(2048 + static_cast<std::uint64_t>(head.metaLen), head.nameLen, scratch);
+        names.assign(table.begin(), table.end());
+
+        std::vector<std::string> decoded = read_names(head, files, names);
+        entries.reserve(files.size());
+        for (std::size_t i = 0; i < files.size(); ++i) entries.push_back({ std::move(decoded[i]), files[i] });
+        return mc2_status::ok;
+    });
+}
+
+mc2_status dat_archive::for_each(const entry_visitor &visit) const {
+    for (const dat_entry &entry : entries) {
+        mc2_status status = visit(entry);
+        if (status != mc2_status::ok) return status;
+    }
+    return mc2_status::ok;
+}
+
+mc2_status dat_archive::payload(std::size_t i, entry_buffers &buffers, span<const char> &out) {
+    const dat_entry &entry = entries[i];
+    return guard(&entry, [&]() {
+        out = in->read(entry.file.dataOffset, entry.file.compressLen, buffers.raw);
+        return mc2_status::ok;
+    });
+}
+
+mc2_status dat_archive::patch(std::size_t i, entry_buffers &buffers, entry_result &result) {
+    const dat_entry &entry = entries[i];
+    return guard(&entry, [&]() {
+        result.verdict = entry_verdict::skip;
+        result.file = entry.file;
+        result.payload = in->read(entry.file.dataOffset, entry.file.compressLen, buffers.raw);
+        if (!is_texture_name({ entry.name.data(), entry.name.size() })) return mc2_status::ok;
+
+        // Lend the caller's buffers to the job, and take them back even if it throws
+        entry_job job(result.file);
+        job.payload = result.payload;
+        job.data.swap(buffers.output), job.buffer.swap(buffers.texture);
+        try {
+            process_texture(job);
+        } catch (...) {
+            job.data.swap(buffers.output), job.buffer.swap(buffers.texture);
+            throw;
+        }
+        job.data.swap(buffers.output), job.buffer.swap(buffers.texture);
+
+        result.payload = job.payload;
+        result.verdict = job.patched ? entry_verdict::patched : job.checked ? entry_verdict::good : entry_verdict::skip;
+        return mc2_status::ok;
+    });
+}
+
+mc2_status dat_archive::write(dat_writer &out, entry_buffers &buffers, const result_visitor &on_entry) {
+    std::vector<file_info> files;
+    mc2_status status = guard(nullptr, [&]() {
+        files.reserve(entries.size());
+        helper_write_at(out, 0, span<const dat_header>(&head, 1));
+        helper_write_at(out, 2048 + static_cast<std::uint64_t>(head.metaLen), span<const std::uint8_t>(names));
+        out.seek(2048 + static_cast<std::uint64_t>(head.metaLen) + head.nameLen);
+        return mc2_status::ok;
+    });
+
+    entry_result result;
+    for (std::size_t i = 0; i < entries.size() && status == mc2_status::ok; ++i) {
+        const dat_entry &entry = entries[i];
+        status = patch(i, buffers, result);
+        if (status == mc2_status::ok && on_entry) {
+            status = guard(&entry, [&]() { return on_entry(entry, result); });
+            if (status == mc2_status::stopped) message = "Stopped by the caller at " + entry.name;
+        }
+        if (status != mc2_status::ok) break;
+
+        status = guard(&entry, [&]() {
+            const std::uint32_t source = result.file.dataOffset;
+            result.file.dataOffset = seek_pad(out, result.payload.size());
+            if (result.verdict == entry_verdict::patched) out.write(result.payload);
+            else out.copy(result.payload, source);
+            files.push_back(result.file);
+            return mc2_status::ok;
+        });
+    }
+    if (status != mc2_status::ok) return status;
+
+    return guard(nullptr, [&]() {
+        // pad end of file
+        out.seek(((out.tell() + 2047) & ~static_cast<std::uint64_t>(2047)) - 1);
+        out.write({ "", 1 });
+        helper_write_at(out, 2048, span<const file_info>(files));
+        return mc2_status::ok;
+    });
+}
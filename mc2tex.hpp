@@ -0,0 +1,89 @@
+#pragma once
+
+// Embedding interface of libmc2tex. dat_archive reports failures as an
+// mc2_status, with the details in error(); nothing is thrown out of it.
+
+#include <cstddef>
+#include <cstdint>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "dat_format.hpp"
+#include "dat_manifest.hpp"
+#include "dat_reader.hpp"
+#include "dat_writer.hpp"
+#include "span.hpp"
+
+enum class mc2_status {
+    ok,
+    stopped,       // a callback asked to stop
+    io_error,      // the reader or writer failed
+    bad_archive,   // header, directory or name table is invalid
+    bad_entry,     // an entry's data is invalid
+    codec_error,   // the deflate stream is corrupt
+    out_of_memory,
+    failed         // anything else
+};
+
+const char *mc2_status_name(mc2_status status);
+
+struct dat_entry {
+    std::string name;
+    file_info file; // as stored in the input archive
+};
+
+// Scratch space owned by the caller. Passing the same buffers for every
+// entry means the steady state doesn't allocate.
+struct entry_buffers {
+    std::vector<char> raw;     // payload read from a reader that can't lend memory
+    std::vector<char> texture; // inflated texture, or a window of a big one
+    std::vector<char> output;  // new compressed payload
+};
+
+struct entry_result {
+    entry_verdict verdict = entry_verdict::skip;
+    file_info file = {};      // describes payload; dataOffset is the input's
+    span<const char> payload; // in the buffers, or memory lent by the reader
+};
+
+class dat_archive {
+public:
+    typedef std::function<mc2_status(const dat_entry &)> entry_visitor;
+    typedef std::function<mc2_status(const dat_entry &, const entry_result &)> result_visitor;
+
+    // Reads the header, directory and name table
+    mc2_status open(dat_reader &in);
+
+    const dat_header &header() const { return head; }
+    std::size_t size() const { return entries.size(); }
+    const dat_entry &entry(std::size_t i) const { return entries[i]; }
+
+    // Calls visit for each entry in directory order until it returns anything but ok
+    mc2_status for_each(const entry_visitor &visit) const;
+
+    // The entry's data as stored, only read when asked for
+    mc2_status payload(std::size_t i, entry_buffers &buffers, span<const char> &out);
+
+    // Checks one entry and fixes it if it is a texture that needs it
+    mc2_status patch(std::size_t i, entry_buffers &buffers, entry_result &result);
+
+    // Patches every entry on the calling thread and writes the new archive to
+    // out, laid out as process_textures does. on_entry sees each result
+    // before it is written and stops the run by returning anything but ok.
+    mc2_status write(dat_writer &out, entry_buffers &buffers, const result_visitor &on_entry = nullptr);
+
+    // What went wrong in the last call that didn't return ok
+    const std::string &error() const { return message; }
+
+private:
+    template<class F> mc2_status guard(const dat_entry *entry, F f);
+
+    dat_reader *in = nullptr;
+    dat_header head = {};
+    std::vector<dat_entry> entries;
+    std::vector<std::uint8_t> names;
+    std::vector<char> scratch;
+    std::string message;
+};
@@ -0,0 +1,191 @@
+#include "name_table.hpp"
+
+#include <cctype>
+#include <cstring>
+
+#include <algorithm>
+
+#include "mc2_exception.hpp"
+#include "xxhash.hpp"
+
+constexpr char chartable[65] = "\0 #$()-./?0123456789_abcdefghijklmnopqrstuvwxyz~++++++++++++++++";
+
+constexpr std::size_t name_table::npos;
+
+static std::uint8_t helper_getBase64(span<const std::uint8_t> n, const std::uint32_t l, const std::uint32_t i) {
+    const size_t k = i / 4;
+    switch (i & 0x3) {
+        case 0: return ((n[l + 3*k + 0] & 0x3F) << 0)                        ; break;
+        case 1: return ((n[l + 3*k + 1] & 0x0F) << 2) | (n[l + 3*k + 0] >> 6); break;
+        case 2: return ((n[l + 3*k + 2] & 0x03) << 4) | (n[l + 3*k + 1] >> 4); break;
+        case 3: return                                  (n[l + 3*k + 2] >> 2); break;
+        default: return -1; // Won't ever happen
+    }
+}
+
+name_table::name_table(const dat_header &header, span<const file_info> files, span<const std::uint8_t> names) {
+    if (header.magic != MAGIC_DAVE && header.magic != MAGIC_Dave) throw mc2_exception("Unknown DAT file format. Maybe a ZIP file?");
+    const bool isBase64 = header.magic == MAGIC_Dave;
+
+    arena.reserve(names.size() * 2);
+    starts.reserve(files.size() + 1);
+    starts.push_back(0);
+    for (const file_info &file : files) {
+        if (isBase64) decode64(names, file);
+        else plain(names, file);
+        if (arena.size() > UINT32_MAX) throw mc2_exception("Name table too large");
+        starts.push_back(static_cast<std::uint32_t>(arena.size()));
+    }
+    index();
+}
+
+void name_table::decode64(span<const std::uint8_t> names, file_info file) {
+    if (file.nameOffset + 2 >= names.size()) throw mc2_exception("Name offset past the end of the name table");
+    uint32_t i = 0;
+    bool truncated = false;
+    {
+        /*
+        * Apparent Delta Encoding Scheme:
+        * First:  111 CBA
+        * Second: 10G FED
+        *
+        * The total number of characters to keep
+        * is the binary value 0GFE DCBA
+        */
+        std::uint8_t v = helper_getBase64(names, file.nameOffset, 0);
+        if (v >= 0x30) {
+            std::uint8_t t = helper_getBase64(names, file.nameOffset, 1);
+            if ((v & 0x78) != 0x38 || (t & 0x70) != 0x20) throw mc2_exception("Invalid Delta Encoding in Base64 DAT");
+            i = 2;
+
+            // Keeping more than the previous name has ends the name right
+            // after it, as a C string of the old buffer did
+            std::size_t keep = (v & 0x07) | ((t & 0x0F) << 3);
+            const std::size_t prev = size() > 0 ? (*this)[size() - 1].size() : 0;
+            if (keep > prev) keep = prev, truncated = true;
+            const std::size_t at = arena.size(), from = size() > 0 ? starts[size() - 1] : 0;
+            arena.resize(at + keep);
+            std::copy(arena.begin() + from, arena.begin() + from + keep, arena.begin() + at);
+        }
+    }
+    char c;
+    do {
+        if (file.nameOffset + 3 * (i / 4) + 2 >= names.size()) throw mc2_exception("Unterminated name in Base64 DAT");
+        std::uint8_t v = helper_getBase64(names, file.nameOffset, i++);
+        c = chartable[v];
+        if (c == '+') throw mc2_exception("Invalid Character in Name for Base64 DAT");
+        if (c != '\0' && !truncated) arena.push_back(c);
+    } while (c != '\0');
+    arena.push_back('\0');
+}
+
+void name_table::plain(span<const std::uint8_t> names, file_info file) {
+    if (file.nameOffset >= names.size()) throw mc2_exception("Name offset past the end of the name table");
+    const char *name = reinterpret_cast<const char *>(names.data()) + file.nameOffset;
+    const char *end = static_cast<const char *>(std::memchr(name, '\0', names.size() - file.nameOffset));
+    if (end == nullptr) throw mc2_exception("Unterminated name in DAT");
+    arena.insert(arena.end(), name, end + 1);
+}
+
+void name_table::index() {
+    std::size_t capacity = 16;
+    while (capacity < 2 * size()) capacity *= 2;
+    slots.assign(capacity, 0);
+    for (std::size_t i = 0; i < size(); ++i) {
+        const span<const char> name = (*this)[i];
+        std::size_t slot = xxhash64(name.data(), name.size()) & (capacity - 1);
+        for (; slots[slot] != 0; slot = (slot + 1) & (capacity - 1)) {
+            const span<const char> other = (*this)[slots[slot] - 1];
+            if (other.size() == name.size() && std::memcmp(other.data(), name.data(), name.size()) == 0) break;
+        }
+        if (slots[slot] == 0) slots[slot] = static_cast<std::uint32_t>(i + 1);
+    }
+}
+
+std::size_t name_table::find(span<const char> name) const {
+    const std::size_t mask = slots.size() - 1;
+    for (std::size_t slot = xxhash64(name.data(), name.size()) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+        const span<const char> other = (*this)[slots[slot] - 1];
+        if (other.size() == name.size() && std::memcmp(other.data(), name.data(), name.size()) == 0) return slots[slot] - 1;
+    }
+    return npos;
+}
+
+static std::uint8_t helper_symbol(char c) {
+    // Symbol 0 ends a name and the '+' ones are unused
+    const char *at = c != '\0' && c != '+' ? std::strchr(chartable + 1, c) : nullptr;
+    if (at == nullptr) throw mc2_exception("Name can't be stored in a Base64 DAT");
+    return static_cast<std::uint8_t>(at - chartable);
+}
+
+std::vector<std::uint8_t> encode_names(const std::vector<std::string> &names, bool base64, std::vector<std::uint32_t> &offsets) {
+    std::vector<std::uint8_t> out;
+    std::vector<std::uint8_t> symbols;
+    offsets.clear();
+    offsets.reserve(names.size());
+    const std::string *prev = nullptr;
+    for (const std::string &name : names) {
+        if (name.find('\0') != std::string::npos) throw mc2_exception("Entry name holds a nul character");
+        if (out.size() > UINT32_MAX) throw mc2_exception("Name table too large");
+        offsets.push_back(static_cast<std::uint32_t>(out.size()));
+        if (!base64) {
+            out.insert(out.end(), name.begin(), name.end());
+            out.push_back(0);
+            continue;
+        }
+
+        // The delta encoding decode64 reads: 111 CBA, 10G FED
+        std::size_t keep = 0;
+        if (prev != nullptr) {
+            const std::size_t limit = std::min<std::size_t>(std::min(prev->size(), name.size()), 127);
+            while (keep < limit && (*prev)[keep] == name[keep]) ++keep;
+        }
+        symbols.clear();
+        if (keep > 0) {
+            symbols.push_back(static_cast<std::uint8_t>(0x38 | (keep & 0x07)));
+            symbols.push_back(static_cast<std::uint8_t>(0x20 | (keep >> 3)));
+        }
+        for (std::size_t i = keep; i < name.size(); ++i) symbols.push_back(helper_symbol(name[i]));
+        do symbols.push_back(0); while (symbols.size() % 4 != 0);
+
+        // Four 6-bit symbols to three bytes, as helper_getBase64 unpacks them
+        for (std::size_t i = 0; i < symbols.size(); i += 4) {
+            const std::uint32_t v = symbols[i] | (symbols[i + 1] << 6) | (symbols[i + 2] << 12) | (symbols[i + 3] << 18);
+            out.push_back(static_cast<std::uint8_t>(v));
+            out.push_back(static_cast<std::uint8_t>(v >> 8));
+            out.push_back(static_cast<std::uint8_t>(v >> 16));
+        }
+        prev = &name;
+    }
+    return out;
+}
+
+static bool helper_same_char(char a, char b) {
+    return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+}
+
+bool glob_match(const char *pattern, span<const char> name) {
+    // Greedy, backtracking only to the last * seen
+    const char *star = nullptr;
+    std::size_t i = 0, resume = 0;
+    while (i < name.size()) {
+        if (*pattern == '*') {
+            star = ++pattern, resume = i;
+        } else if (*pattern != '\0' && (*pattern == '?' || helper_same_char(*pattern, name[i]))) {
+            ++pattern, ++i;
+        } else if (star != nullptr) {
+            pattern = star, i = ++resume;
+        } else return false;
+    }
+    while (*pattern == '*') ++pattern;
+    return *pattern == '\0';
+}
+
+bool name_filter::selects(span<const char> name) const {
+    for (const std::string &glob : excluded)
+        if (glob_match(glob.c_str(), name)) return false;
+    if (included.empty()) return true;
+    for (const std::string &glob : included)
+        if (glob_match(glob.c_str(), name)) return true;
+    return false;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+#include "dat_format.hpp"
+#include "span.hpp"
+
+// Every entry name of an archive, decoded once into one arena (each name
+// nul-terminated) with a hash index over them. Names come back as spans
+// into the arena, valid for the table's lifetime.
+class name_table {
+public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    name_table(const dat_header &header, span<const file_info> files, span<const std::uint8_t> names);
+
+    std::size_t size() const { return starts.size() - 1; }
+    span<const char> operator[](std::size_t i) const {
+        return { arena.data() + starts[i], starts[i + 1] - starts[i] - 1 };
+    }
+
+    // Entry called name, the first one if several are; npos if none is
+    std::size_t find(span<const char> name) const;
+    std::size_t find(const std::string &name) const { return find(span<const char>(name.data(), name.size())); }
+
+private:
+    void decode64(span<const std::uint8_t> names, file_info file);
+    void plain(span<const std::uint8_t> names, file_info file);
+    void index();
+
+    std::vector<char> arena;
+    std::vector<std::uint32_t> starts; // of each name in arena, and the end
+    std::vector<std::uint32_t> slots;  // open addressing, entry + 1 or 0 when free
+};
+
+// Encodes names, in order, as the name table of a plain (MAGIC_DAVE) or
+// Base64 (MAGIC_Dave) archive, where each name reuses what it shares with
+// the one before. offsets gets where each name starts.
+std::vector<std::uint8_t> encode_names(const std::vector<std::string> &names, bool base64, std::vector<std::uint32_t> &offsets);
+
+// Shell-style match where * may also cross '/'. Case is ignored, since the
+// archives only store lower case names.
+bool glob_match(const char *pattern, span<const char> name);
+
+// --only / --exclude: a name is selected if it matches any of the included
+// globs (or there are none) and none of the excluded ones
+class name_filter {
+public:
+    void only(const std::string &glob) { included.push_back(glob); }
+    void exclude(const std::string &glob) { excluded.push_back(glob); }
+
+    bool empty() const { return included.empty() && excluded.empty(); }
+    bool selects(span<const char> name) const;
+
+private:
+    std::vector<std::string> included, excluded;
+};
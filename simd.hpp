@@ -0,0 +1,18 @@
+#pragma once
+
+// x86 vector paths are built with target attributes rather than global
+// compiler flags, and picked at run time with cpu_has_avx2.
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#define MC2_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define MC2_TARGET_AVX2
+#else
+#define MC2_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// AVX2, with the YMM registers saved by the OS
+bool cpu_has_avx2();
+#endif
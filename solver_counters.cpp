@@ -0,0 +1,99 @@
+#include "solver_counters.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+
+static const char *const PathNames[SolverPaths] = { "swap", "reframe", "squeeze", "outer", "two", "three", "cached" };
+static const char *const PickNames[SolverPicks] = { "iiix", "xiii", "iixi", "ixii", "ixxi", "ixix", "xiix" };
+
+constexpr std::size_t WorstTextures = 10;
+
+#ifdef MC2_SOLVER_COUNTERS
+thread_local solver_counters *Solver_Counts = nullptr;
+
+bool solver_counters_available() { return true; }
+#else
+bool solver_counters_available() { return false; }
+#endif
+
+bool solver_counters::empty() const {
+    for (std::uint64_t n : paths)
+        if (n != 0) return false;
+    return true;
+}
+
+solver_counters &solver_counters::operator+=(const solver_counters &other) {
+    for (std::size_t i = 0; i < SolverPaths; ++i) paths[i] += other.paths[i];
+    for (std::size_t i = 0; i < SolverPicks; ++i) picks[i] += other.picks[i];
+    for (std::size_t i = 0; i < SolverErrorBuckets; ++i) errors[i] += other.errors[i];
+    err2Sum += other.err2Sum;
+    err2Max = std::max(err2Max, other.err2Max);
+    return *this;
+}
+
+static std::uint64_t helper_picks(const solver_counters &c) {
+    std::uint64_t n = 0;
+    for (std::uint64_t k : c.picks) n += k;
+    return n;
+}
+
+void solver_counters::print_line(std::ostream &out) const {
+    const char *sep = "";
+    for (std::size_t i = 0; i < SolverPaths; ++i)
+        if (paths[i] != 0) out << sep << PathNames[i] << ' ' << paths[i], sep = ", ";
+    const std::uint64_t n = helper_picks(*this);
+    if (n == 0) return;
+    out << ';';
+    for (std::size_t i = 0; i < SolverPicks; ++i)
+        if (picks[i] != 0) out << ' ' << PickNames[i] << ' ' << picks[i];
+    out << "; err2 mean " << err2Sum / n << " max " << err2Max;
+}
+
+void solver_report::add(const std::string &name, const solver_counters &texture) {
+    if (texture.empty()) return;
+    total += texture;
+    ++textures;
+    if (helper_picks(texture) == 0) return;
+    const auto larger = [](const std::pair<std::uint64_t, std::string> &a, const std::pair<std::uint64_t, std::string> &b) {
+        return a.first > b.first;
+    };
+    worst.insert(std::upper_bound(worst.begin(), worst.end(), std::make_pair(texture.err2Max, name), larger),
+                 std::make_pair(texture.err2Max, name));
+    if (worst.size() > WorstTextures) worst.pop_back();
+}
+
+void solver_report::print(std::ostream &out) const {
+    std::uint64_t blocks = 0;
+    for (std::uint64_t n : total.paths) blocks += n;
+    const std::uint64_t picks = helper_picks(total);
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+
+    out << "Solver: " << blocks << " blocks rewritten in " << textures << " textures" << '\n';
+    for (std::size_t i = 0; i < SolverPaths; ++i) {
+        out << "  " << std::left << std::setw(8) << PathNames[i] << std::right << std::setw(12) << total.paths[i]
+            << std::setw(7) << (blocks != 0 ? 100.0 * total.paths[i] / blocks : 0.0) << " %" << '\n';
+    }
+    out << "Picks: " << picks << '\n';
+    for (std::size_t i = 0; i < SolverPicks; ++i) {
+        out << "  " << std::left << std::setw(8) << PickNames[i] << std::right << std::setw(12) << total.picks[i]
+            << std::setw(7) << (picks != 0 ? 100.0 * total.picks[i] / picks : 0.0) << " %" << '\n';
+    }
+    if (picks != 0) {
+        out << "err2 of the picks: mean " << static_cast<double>(total.err2Sum) / picks << ", max " << total.err2Max << '\n';
+        for (std::size_t k = 0; k < SolverErrorBuckets; ++k) {
+            if (total.errors[k] == 0) continue;
+            out << "  " << std::setw(12) << (k == 0 ? 0 : std::uint64_t(1) << (k - 1)) << " .. "
+                << std::left << std::setw(12) << (k == 0 ? 0 : (std::uint64_t(1) << k) - 1) << std::right
+                << std::setw(12) << total.errors[k] << '\n';
+        }
+    }
+    if (!worst.empty()) {
+        out << "Largest err2:" << '\n';
+        for (const auto &texture : worst) out << "  " << std::setw(12) << texture.first << "  " << texture.second << '\n';
+    }
+    out << std::flush;
+    out.flags(flags), out.precision(precision);
+}
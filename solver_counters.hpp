@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+// What the DXT5 fix did with the blocks it rewrote
+enum class solver_path {
+    swap,    // cs0 < cs1 without a 10b index: only reframed
+    reframe, // cs0 == cs1
+    squeeze, // handle1, one color
+    outer,   // handle2 keeping iixx
+    two,     // handle2 choosing among its candidates
+    three,   // handle3
+    cached   // taken from the block cache, or from a copy solved alongside
+};
+constexpr std::size_t SolverPaths = 7;
+
+// The candidate encodings handle2 and handle3 pick from
+enum class solver_pick { iiix, xiii, iixi, ixii, ixxi, ixix, xiix };
+constexpr std::size_t SolverPicks = 7;
+
+// err2 of the picks: 0, then [2^(k-1), 2^k) in bucket k
+constexpr std::size_t SolverErrorBuckets = 32;
+
+struct solver_counters {
+    std::uint64_t paths[SolverPaths] = {};
+    std::uint64_t picks[SolverPicks] = {};
+    std::uint64_t errors[SolverErrorBuckets] = {};
+    std::uint64_t err2Sum = 0, err2Max = 0;
+
+    void pick(solver_pick p, std::uint64_t err2) {
+        ++picks[static_cast<std::size_t>(p)];
+        std::size_t bucket = 0;
+        while (bucket + 1 < SolverErrorBuckets && err2 >> bucket != 0) ++bucket;
+        ++errors[bucket];
+        err2Sum += err2;
+        if (err2 > err2Max) err2Max = err2;
+    }
+
+    bool empty() const;
+    solver_counters &operator+=(const solver_counters &other);
+    // One line: the paths and picks taken and the mean and worst err2
+    void print_line(std::ostream &out) const;
+};
+
+// --solver-stats over one archive: every texture's counts, and the
+// textures whose fix left the largest error
+class solver_report {
+public:
+    void add(const std::string &name, const solver_counters &texture);
+    void print(std::ostream &out) const;
+
+private:
+    solver_counters total;
+    std::size_t textures = 0;
+    std::vector<std::pair<std::uint64_t, std::string>> worst; // err2Max and name, largest first
+};
+
+// Built with -DMC2_SOLVER_COUNTERS=ON (CMake option MC2_SOLVER_COUNTERS).
+// Without it the hooks below are empty and --solver-stats is unavailable.
+bool solver_counters_available();
+
+#ifdef MC2_SOLVER_COUNTERS
+// Counts of the texture the calling thread is fixing, while it points somewhere
+extern thread_local solver_counters *Solver_Counts;
+
+inline void count_path(solver_path p, std::uint64_t n = 1) {
+    if (Solver_Counts != nullptr) Solver_Counts->paths[static_cast<std::size_t>(p)] += n;
+}
+inline void count_pick(solver_pick p, std::uint64_t err2) {
+    if (Solver_Counts != nullptr) Solver_Counts->pick(p, err2);
+}
+#else
+inline void count_path(solver_path, std::uint64_t = 1) { }
+inline void count_pick(solver_pick, std::uint64_t) { }
+#endif
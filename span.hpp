@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+
+#include <type_traits>
+#include <vector>
+
+// Minimal non-owning view over contiguous memory (std::span is C++20)
+template<class T> class span {
+public:
+    constexpr span() : ptr(nullptr), len(0) { }
+    constexpr span(T *ptr, std::size_t len) : ptr(ptr), len(len) { }
+    template<class U, class = typename std::enable_if<std::is_convertible<U *, T *>::value>::type>
+    span(std::vector<U> &v) : ptr(v.data()), len(v.size()) { }
+    template<class U, class = typename std::enable_if<std::is_convertible<const U *, T *>::value>::type>
+    span(const std::vector<U> &v) : ptr(v.data()), len(v.size()) { }
+
+    constexpr T *data() const { return ptr; }
+    constexpr std::size_t size() const { return len; }
+    constexpr bool empty() const { return len == 0; }
+    constexpr T *begin() const { return ptr; }
+    constexpr T *end() const { return ptr + len; }
+    constexpr T &operator[](std::size_t i) const { return ptr[i]; }
+
+    constexpr span first(std::size_t n) const { return { ptr, n }; }
+    constexpr span subspan(std::size_t off, std::size_t n) const { return { ptr + off, n }; }
+
+private:
+    T *ptr;
+    std::size_t len;
+};
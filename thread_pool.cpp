@@ -0,0 +1,45 @@
+#include "thread_pool.hpp"
+
+thread_pool::thread_pool(unsigned threads) {
+    if (threads == 0) threads = hardware_threads();
+    workers.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i)
+        workers.emplace_back(&thread_pool::worker, this);
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (std::thread &t : workers) t.join();
+    // Jobs that never started are dropped; their futures report broken_promise
+}
+
+unsigned thread_pool::hardware_threads() {
+    unsigned threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : threads;
+}
+
+void thread_pool::push(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        jobs.push_back(std::move(job));
+    }
+    ready.notify_one();
+}
+
+void thread_pool::worker() {
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [this]() { return stopping || !jobs.empty(); });
+            if (stopping) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
@@ -0,0 +1,49 @@
+#include "xxhash.hpp"
+
+#include <cstring>
+
+static constexpr std::uint64_t P1 = 0x9E3779B185EBCA87ULL;
+static constexpr std::uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr std::uint64_t P3 = 0x165667B19E3779F9ULL;
+static constexpr std::uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr std::uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+static inline std::uint64_t rotl(std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline std::uint64_t read64(const unsigned char *p) { std::uint64_t v; std::memcpy(&v, p, 8); return v; }
+static inline std::uint32_t read32(const unsigned char *p) { std::uint32_t v; std::memcpy(&v, p, 4); return v; }
+
+static inline std::uint64_t round(std::uint64_t acc, std::uint64_t input) {
+    return rotl(acc + input * P2, 31) * P1;
+}
+
+static inline std::uint64_t merge(std::uint64_t acc, std::uint64_t val) {
+    return (acc ^ round(0, val)) * P1 + P4;
+}
+
+std::uint64_t xxhash64(const void *data, std::size_t len, std::uint64_t seed) {
+    const unsigned char *p = static_cast<const unsigned char *>(data), *const end = p + len;
+    std::uint64_t h;
+
+    if (len >= 32) {
+        std::uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        const unsigned char *const limit = end - 32;
+        do {
+            v1 = round(v1, read64(p)), v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16)), v4 = round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(h, v1), h = merge(h, v2), h = merge(h, v3), h = merge(h, v4);
+    } else h = seed + P5;
+
+    h += static_cast<std::uint64_t>(len);
+    for (; p + 8 <= end; p += 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3, p += 4;
+    for (; p < end; ++p) h = rotl(h ^ (*p * P5), 11) * P1;
+
+    h ^= h >> 33, h *= P2;
+    h ^= h >> 29, h *= P3;
+    h ^= h >> 32;
+    return h;
+}
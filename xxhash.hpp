@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH64 by Yann Collet, used to recognise unchanged entries
+std::uint64_t xxhash64(const void *data, std::size_t len, std::uint64_t seed = 0);
@@ -0,0 +1,42 @@
+#include <cstring>
+
+#include <zlib.h>
+
+#include "mc2_exception.hpp"
+#include "zlib_streams.hpp"
+
+zlib_streams::~zlib_streams() {
+    if (inflating) inflateEnd(&inf);
+    if (deflating) deflateEnd(&def);
+}
+
+z_stream &zlib_streams::inflater() {
+    int ret;
+    if (!inflating) {
+        std::memset(&inf, 0, sizeof(inf));
+        ret = inflateInit2(&inf, -MAX_WBITS);
+        if (ret != Z_OK) throw zlib_exception(ret, inf.msg);
+        inflating = true;
+    } else if ((ret = inflateReset(&inf)) != Z_OK) throw zlib_exception(ret, inf.msg);
+    return inf;
+}
+
+z_stream &zlib_streams::deflater(int wanted) {
+    int ret;
+    if (deflating && wanted != level) {
+        deflateEnd(&def);
+        deflating = false;
+    }
+    if (!deflating) {
+        std::memset(&def, 0, sizeof(def));
+        ret = deflateInit2(&def, wanted, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+        if (ret != Z_OK) throw zlib_exception(ret, def.msg);
+        deflating = true, level = wanted;
+    } else if ((ret = deflateReset(&def)) != Z_OK) throw zlib_exception(ret, def.msg);
+    return def;
+}
+
+zlib_streams &thread_zlib_streams() {
+    thread_local zlib_streams streams;
+    return streams;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Raw zlib streams of the calling thread, for the paths that need zlib's
+// streaming API whatever Codec_Backend is. Internal to the library;
+// include after zlib.h.
+
+struct zlib_streams {
+    z_stream inf, def;
+    bool inflating = false, deflating = false;
+    int level = 0;
+
+    zlib_streams() = default;
+    zlib_streams(const zlib_streams &) = delete;
+    zlib_streams &operator=(const zlib_streams &) = delete;
+    ~zlib_streams();
+
+    // Both hand back a fresh stream, set up on first use and reset after
+    z_stream &inflater();
+    // Same settings as the zlib codec, so the same input deflates the same
+    z_stream &deflater(int level);
+};
+
+zlib_streams &thread_zlib_streams();